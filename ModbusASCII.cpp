@@ -1,10 +1,11 @@
+#include <string.h>
 #include "ModbusASCII.h"
+#include "ModbusUtil.h"
 #ifdef _MSC_VER
 #undef max
 #endif
 #define ISXDIGIT(ch) (((ch) >= '0' && (ch) <= '9') || ((ch) >= 'A' && (ch) <= 'F') || ((ch) >= 'a' && (ch) <= 'f'))
 #define ASC2BIN(ch) ((ch) <= '9' ? (ch) - '0' : ((ch) | 0x20) - 'a' + 10)
-#define BIN2ASC(n) ((n) <= 9 ? (char)((n) + '0') : (char)((n) - 10 + 'A'))
 namespace ModbusPotato
 {
     // calculate the amount of time elapsed
@@ -31,6 +32,8 @@ namespace ModbusPotato
         ,   m_state(state_idle)
         ,   m_last_ticks()
         ,   m_T1s()
+        ,   m_chunk_pos()
+        ,   m_chunk_len()
     {
         if (!m_stream || !m_timer || !m_buffer || m_buffer_max < 3)
         {
@@ -50,6 +53,56 @@ namespace ModbusPotato
         m_T1s = milliseconds * 1000 / m_timer->microseconds_per_tick();
     }
 
+    int CModbusASCII::rx_fill()
+    {
+        // read as much as the staging area will hold in a single call
+        int ec = m_stream->read(m_chunk, sizeof(m_chunk));
+        m_chunk_pos = 0;
+        m_chunk_len = ec > 0 ? (uint8_t)ec : 0;
+        return ec;
+    }
+
+    void CModbusASCII::tx_fill(size_t len)
+    {
+        // encode as much of the rest of the PDU as fits
+        if (m_buffer_tx_pos < m_buffer_len)
+        {
+            size_t n = m_buffer_len - m_buffer_tx_pos;
+            if (n > (chunk_size - len) / 2)
+                n = (chunk_size - len) / 2;
+            encode_hex(m_buffer + m_buffer_tx_pos, n, m_chunk + len, &m_checksum);
+            m_buffer_tx_pos += (uint8_t)n;
+            len += 2 * n;
+        }
+
+        // add the end of the frame once the PDU is complete and there is room for it
+        if (m_buffer_tx_pos == m_buffer_len && chunk_size - len >= 4)
+        {
+            // negate the checksum (2's complement) so that everything will add to 0 at the receiving end
+            uint8_t lrc = (uint8_t)-(int8_t)m_checksum;
+            encode_hex(&lrc, 1, m_chunk + len, NULL);
+            m_chunk[len + 2] = '\r';
+            m_chunk[len + 3] = '\n';
+            len += 4;
+            m_state = state_tx_lrc;
+        }
+
+        m_chunk_pos = 0;
+        m_chunk_len = (uint8_t)len;
+    }
+
+    int CModbusASCII::tx_flush()
+    {
+        while (m_chunk_pos != m_chunk_len)
+        {
+            int ec = m_stream->write(m_chunk + m_chunk_pos, m_chunk_len - m_chunk_pos);
+            if (ec <= 0)
+                return ec;
+            m_chunk_pos += (uint8_t)ec;
+        }
+        return 1;
+    }
+
     unsigned long CModbusASCII::poll()
     {
         // state machine for handling incoming data
@@ -69,19 +122,34 @@ namespace ModbusPotato
         case state_idle: // waiting for something to happen
 idle:       
             {
-                while (int ec = m_stream->read(&m_frame_address, 1))
+                for (;;)
                 {
-                    // make sure the character was read properly and that it's the start of frame
-                    if (ec > 0 && m_frame_address == ':')
+                    // refill the staging area once it has been consumed
+                    if (m_chunk_pos == m_chunk_len)
                     {
-                        // if so, go to the ascii rx address high state
-                        m_state = state_rx_addr_high;
-                        m_last_ticks = m_timer->ticks();
-                        m_stream->communicationStatus(true, false);
-                        goto rx_addr;
+                        int ec = rx_fill();
+                        if (!ec)
+                            return 0; // waiting for an event
+                        if (ec < 0)
+                            continue; // read error, keep on looking
+                    }
+
+                    // look for the start of frame in what is left of the chunk
+                    const uint8_t* sof = (const uint8_t*)memchr(m_chunk + m_chunk_pos, ':', m_chunk_len - m_chunk_pos);
+                    if (!sof)
+                    {
+                        // nothing in this chunk, drop it
+                        m_chunk_pos = m_chunk_len;
+                        continue;
                     }
+
+                    // if so, go to the ascii rx address high state
+                    m_chunk_pos = (uint8_t)(sof - m_chunk + 1);
+                    m_state = state_rx_addr_high;
+                    m_last_ticks = m_timer->ticks();
+                    m_stream->communicationStatus(true, false);
+                    goto rx_addr;
                 }
-                return 0; // waiting for an event
             }
             break;
         case state_frame_ready: // waiting for the application layer to process the frame
@@ -94,7 +162,12 @@ idle:
                 // re-transmitting, or there are multiple masters or slaves
                 // with the same address.
                 //
-                if (m_stream->read(NULL, (size_t)-1))
+                // Note: anything left in the staging area arrived after the
+                // frame as well, so it is dropped along with the stream.
+                //
+                bool staged = m_chunk_pos != m_chunk_len;
+                m_chunk_pos = m_chunk_len;
+                if (m_stream->read(NULL, (size_t)-1) || staged)
                 {
                     m_state = state_collision;
                     m_last_ticks = m_timer->ticks();
@@ -110,80 +183,87 @@ idle:
         case state_rx_addr_low:
 rx_addr:
             {
-                // check how much time has elapsed
-                system_tick_t elapsed = ELAPSED(m_last_ticks, m_timer->ticks());
-                if (elapsed > m_T1s)
+                system_tick_t now = m_timer->ticks();
+                for (;;)
                 {
-                    // timeout, go to the idle state
-                    m_state = state_idle;
-                    m_stream->communicationStatus(false, false);
-                    goto idle; // enter the 'idle' state
-                }
+                    // check how much time has elapsed
+                    system_tick_t elapsed = ELAPSED(m_last_ticks, now);
+                    if (elapsed > m_T1s)
+                    {
+                        // timeout, go to the idle state
+                        m_state = state_idle;
+                        m_stream->communicationStatus(false, false);
+                        goto idle; // enter the 'idle' state
+                    }
 
-                // attempt to read the next character
-                uint8_t ch;
-                int result = m_stream->read(&ch, 1);
-                if (result < 0)
-                {
-                    // read error, go to the idle state
-                    m_state = state_idle;
-                    m_stream->communicationStatus(false, false);
-                    goto idle; // enter the 'idle' state
-                }
+                    // attempt to read the next chunk if the staging area is empty
+                    if (m_chunk_pos == m_chunk_len)
+                    {
+                        int result = rx_fill();
+                        if (result < 0)
+                        {
+                            // read error, go to the idle state
+                            m_state = state_idle;
+                            m_stream->communicationStatus(false, false);
+                            goto idle; // enter the 'idle' state
+                        }
 
-                // check if anything was done
-                if (!result)
-                    return m_T1s - elapsed; // wait for the timeout
+                        // check if anything was done
+                        if (!result)
+                            return m_T1s - elapsed; // wait for the timeout
+                    }
+                    uint8_t ch = m_chunk[m_chunk_pos++];
 
-                // check if we got the start of frame character
-                if (ch == ':')
-                {
-                    // if so, start over and go back to the rx_addr_high state
-                    m_state = state_rx_addr_high;
-                    m_last_ticks = m_timer->ticks();
-                    goto rx_addr;
-                }
+                    // check if we got the start of frame character
+                    if (ch == ':')
+                    {
+                        // if so, start over and go back to the rx_addr_high state
+                        m_state = state_rx_addr_high;
+                        m_last_ticks = now;
+                        continue;
+                    }
 
-                // make sure the character is valid
-                if (!ISXDIGIT(ch))
-                {
-                    // invalid character, go to the idle state
-                    m_state = state_idle;
-                    goto idle; // enter the 'idle' state
-                }
+                    // make sure the character is valid
+                    if (!ISXDIGIT(ch))
+                    {
+                        // invalid character, go to the idle state
+                        m_state = state_idle;
+                        goto idle; // enter the 'idle' state
+                    }
 
-                // convert the character from ascii to binary
-                ch = ASC2BIN(ch);
+                    // convert the character from ascii to binary
+                    ch = ASC2BIN(ch);
 
-                // check if we have read the low nibble yet
-                if (m_state == state_rx_addr_high)
-                {
-                    // if not, read low nibble state
-                    m_frame_address = ch;
-                    m_state = state_rx_addr_low;
-                    m_last_ticks = m_timer->ticks();
-                    goto rx_addr;
-                }
+                    // check if we have read the low nibble yet
+                    if (m_state == state_rx_addr_high)
+                    {
+                        // if not, read low nibble state
+                        m_frame_address = ch;
+                        m_state = state_rx_addr_low;
+                        m_last_ticks = now;
+                        continue;
+                    }
 
-                // shift the low nibble into the frame address
-                m_frame_address <<= 4;
-                m_frame_address |= ch;
+                    // shift the low nibble into the frame address
+                    m_frame_address <<= 4;
+                    m_frame_address |= ch;
 
-                // check to see if the frame address matches our station address
-                if (m_station_address && m_frame_address && m_station_address != m_frame_address)
-                {
-                    // no match, go back to the idle state
-                    m_state = state_idle;
-                    m_stream->communicationStatus(false, false);
-                    goto idle;
-                }
+                    // check to see if the frame address matches our station address
+                    if (m_station_address && m_frame_address && m_station_address != m_frame_address)
+                    {
+                        // no match, go back to the idle state
+                        m_state = state_idle;
+                        m_stream->communicationStatus(false, false);
+                        goto idle;
+                    }
 
-                // initialize the checksum and the data buffer
-                m_checksum = m_frame_address;
-                m_buffer_len = 0;
-                m_state = state_rx_pdu_high;
-                m_last_ticks = m_timer->ticks();
-                goto rx_pdu;
+                    // initialize the checksum and the data buffer
+                    m_checksum = m_frame_address;
+                    m_buffer_len = 0;
+                    m_state = state_rx_pdu_high;
+                    m_last_ticks = now;
+                    goto rx_pdu;
+                }
             }
             break;
         case state_rx_pdu_high: // receiving the high or low byte of the PDU [ASCII]
@@ -203,27 +283,94 @@ rx_pdu:
                         goto idle; // enter the 'idle' state
                     }
 
-                    // attempt to read the next character
-                    uint8_t ch;
-                    int result = m_stream->read(&ch, 1);
-                    if (result < 0)
+                    // attempt to read the next chunk if the staging area is empty
+                    if (m_chunk_pos == m_chunk_len)
                     {
-                        // read error, go to the idle state
-                        m_state = state_idle;
-                        m_stream->communicationStatus(false, false);
-                        goto idle; // enter the 'idle' state
+                        int result = rx_fill();
+                        if (result < 0)
+                        {
+                            // read error, go to the idle state
+                            m_state = state_idle;
+                            m_stream->communicationStatus(false, false);
+                            goto idle; // enter the 'idle' state
+                        }
+
+                        // check if anything was done
+                        if (!result)
+                            return m_T1s - elapsed; // wait for the timeout
                     }
 
-                    // check if anything was done
-                    if (!result)
-                        return m_T1s - elapsed; // wait for the timeout
+                    // only decode up to the end of the message, if it is in this chunk
+                    const uint8_t* p = m_chunk + m_chunk_pos;
+                    const uint8_t* end = m_chunk + m_chunk_len;
+                    const uint8_t* cr = (const uint8_t*)memchr(p, '\r', end - p);
+                    if (cr)
+                        end = cr;
+
+                    // decode the hex characters and update the checksum
+                    //
+                    // Note: the state is kept in locals inside of the loop and
+                    // stored back once the run of characters has ended.
+                    //
+                    uint8_t* buffer = m_buffer;
+                    size_t len = m_buffer_len;
+                    uint8_t checksum = m_checksum;
+                    bool high = m_state == state_rx_pdu_high;
+                    while (p != end)
+                    {
+                        // decode the whole pairs in bulk when between bytes
+                        if (high)
+                        {
+                            size_t pairs = (size_t)(end - p) / 2;
+                            if (pairs > m_buffer_max - len)
+                                pairs = m_buffer_max - len;
+                            size_t decoded = decode_hex(p, pairs, buffer + len, &checksum);
+                            p += 2 * decoded;
+                            len += decoded;
+                            if (p == end)
+                                break;
+                        }
+
+                        // otherwise take one character at a time
+                        uint8_t ch = *p;
+
+                        // make sure the character is valid and that we have not over-run the end of the buffer
+                        if (!ISXDIGIT(ch) || len == m_buffer_max)
+                            break;
+                        ch = ASC2BIN(ch);
+                        ++p;
+
+                        // check if we have read the low nibble yet
+                        if (high)
+                        {
+                            // if not, store the high nibble
+                            buffer[len] = ch;
+                            high = false;
+                            continue;
+                        }
+
+                        // shift the low nibble into the data buffer and update the checksum
+                        uint8_t b = (uint8_t)(buffer[len] << 4 | ch);
+                        buffer[len++] = b;
+                        checksum = (uint8_t)(checksum + b);
+                        high = true;
+                    }
+                    m_buffer_len = len;
+                    m_checksum = checksum;
+                    m_state = high ? state_rx_pdu_high : state_rx_pdu_low;
+                    m_chunk_pos = (uint8_t)(p - m_chunk);
+                    m_last_ticks = now;
+
+                    // check if the whole chunk was consumed
+                    if (m_chunk_pos == m_chunk_len)
+                        continue;
+                    uint8_t ch = m_chunk[m_chunk_pos++];
 
                     // check if we got the start of frame character
                     if (ch == ':')
                     {
                         // if so, start over and go back to the rx_addr_high state
                         m_state = state_rx_addr_high;
-                        m_last_ticks = now;
                         goto rx_addr;
                     }
 
@@ -240,43 +387,13 @@ rx_pdu:
 
                         // got carriage return, wait for the final line feed
                         m_state = state_rx_cr;
-                        m_last_ticks = m_timer->ticks();
                         goto rx_cr;
                     }
 
-                    // make sure the character is valid and that we have not over-run the end of the buffer
-                    if (!ISXDIGIT(ch) || m_buffer_len == m_buffer_max)
-                    {
-                        // invalid character or too many characters, go to the idle state
-                        m_state = state_idle;
-                        m_stream->communicationStatus(false, false);
-                        goto idle; // enter the 'idle' state
-                    }
-
-                    // convert the character from ascii to binary
-                    ch = ASC2BIN(ch);
-
-                    // check if we have read the low nibble yet
-                    if (m_state == state_rx_pdu_high)
-                    {
-                        // if not, go to the read low nibble state
-                        m_buffer[m_buffer_len] = ch;
-                        m_state = state_rx_pdu_low;
-                        m_last_ticks = now;
-                        continue;
-                    }
-
-                    // shift the low nibble into the data buffer
-                    uint8_t& bufp = m_buffer[m_buffer_len];
-                    bufp <<= 4;
-                    bufp |= ch;
-
-                    // update the checksum and move to the next character
-                    m_checksum = (uint8_t)(m_checksum + bufp);
-                    m_buffer_len++;
-                    m_state = state_rx_pdu_high;
-                    m_last_ticks = now;
-                    continue;
+                    // invalid character or too many characters, go to the idle state
+                    m_state = state_idle;
+                    m_stream->communicationStatus(false, false);
+                    goto idle; // enter the 'idle' state
                 }
             }
             break;
@@ -293,20 +410,23 @@ rx_cr:
                     goto idle; // enter the 'idle' state
                 }
 
-                // attempt to read the next character
-                uint8_t ch;
-                int result = m_stream->read(&ch, 1);
-                if (result < 0)
+                // attempt to read the next chunk if the staging area is empty
+                if (m_chunk_pos == m_chunk_len)
                 {
-                    // read error, go to the idle state
-                    m_state = state_idle;
-                    m_stream->communicationStatus(false, false);
-                    goto idle; // enter the 'idle' state
-                }
+                    int result = rx_fill();
+                    if (result < 0)
+                    {
+                        // read error, go to the idle state
+                        m_state = state_idle;
+                        m_stream->communicationStatus(false, false);
+                        goto idle; // enter the 'idle' state
+                    }
 
-                // check if anything was done
-                if (!result)
-                    return m_T1s - elapsed; // wait for the timeout
+                    // check if anything was done
+                    if (!result)
+                        return m_T1s - elapsed; // wait for the timeout
+                }
+                uint8_t ch = m_chunk[m_chunk_pos++];
 
                 // check if we got the start of frame character
                 if (ch == ':')
@@ -318,7 +438,7 @@ rx_cr:
                 }
 
                 // make sure we got the line feed and that the checksum is correct
-                if (ch != '\n' && m_buffer_len >= min_pdu_length && m_checksum == 0)
+                if (ch != '\n' || m_buffer_len < min_pdu_length || m_checksum != 0)
                 {
                     // if not, drop the packet and go back to the 'idle' state
                     m_state = state_idle;
@@ -342,251 +462,40 @@ rx_cr:
                 return poll(); // jump to the start of the function to re-evalutate entire switch statement
             }
             break;
-        case state_tx_sof: // transmitting start of frame character [ASCII]
+        case state_tx_pdu: // transmitting the frame [ASCII]
+        case state_tx_lrc:
             {
-                // try and write the start of frame character
-                uint8_t ch = ':';
-                if (int ec = m_stream->write(&ch, 1))
-                {
-                    // check if something bad happened
-                    if (ec < 0)
-                    {
-                        m_state = state_exception;
-                        m_stream->communicationStatus(false, false);
-                        return 0; // fatal exception
-                    }
-
-                    // SOF; move to the 'TX ADDR HIGH' state
-                    m_state = state_tx_addr_high;
-                    goto tx_addr_high;
-                }
-
-                return 0; // waiting for room in the write buffer
-            }
-        case state_tx_addr_high: // transmitting remote station address [ASCII]
-tx_addr_high:
-            {
-                // convert the high nibble of the station address to ASCII HEX
-                uint8_t ch = m_frame_address >> 4;
-                ch = BIN2ASC(ch);
-
-                // try and write the remote station address
-                if (int ec = m_stream->write(&ch, 1))
-                {
-                    // check if something bad happened
-                    if (ec < 0)
-                    {
-                        m_state = state_exception;
-                        m_stream->communicationStatus(false, false);
-                        return 0; // fatal exception
-                    }
-
-                    // high nibble of address sent; now send the low nibble
-                    m_checksum = m_frame_address;
-                    m_state = state_tx_addr_low;
-                    goto tx_addr_low;
-                }
-
-                return 0; // waiting for room in the write buffer
-            }
-            break;
-        case state_tx_addr_low: // transmitting remote station address [ASCII]
-tx_addr_low:
-            {
-                // convert the low nibble of the station address to ASCII HEX
-                uint8_t ch = m_frame_address & 0xf;
-                ch = BIN2ASC(ch);
-
-                // try and write the remote station address
-                if (int ec = m_stream->write(&ch, 1))
-                {
-                    // check if something bad happened
-                    if (ec < 0)
-                    {
-                        m_state = state_exception;
-                        m_stream->communicationStatus(false, false);
-                        return 0; // fatal exception
-                    }
-
-                    // low nibble of address sent; now send the high nibble of the first PDU byte
-                    m_state = state_tx_pdu_high;
-                    m_buffer_tx_pos = 0;
-                    goto tx_pdu_high;
-                }
-
-                return 0; // waiting for room in the write buffer
-            }
-            break;
-        case state_tx_pdu_high: // transmitting PDU [ASCII]
-tx_pdu_high:
-            {
-                // convert the high nibble of the next PDU byte to ASCII HEX
-                uint8_t ch = m_buffer[m_buffer_tx_pos] >> 4;
-                ch = BIN2ASC(ch);
-
-                // try and write the remote station address
-                if (int ec = m_stream->write(&ch, 1))
-                {
-                    // check if something bad happened
-                    if (ec < 0)
-                    {
-                        m_state = state_exception;
-                        m_stream->communicationStatus(false, false);
-                        return 0; // fatal exception
-                    }
-
-                    // high nibble of address sent; update checksum and send the low nibble
-                    m_checksum = (uint8_t)(m_checksum + m_buffer[m_buffer_tx_pos]);
-                    m_state = state_tx_pdu_low;
-                    goto tx_pdu_low;
-                }
-
-                return 0; // waiting for room in the write buffer
-            }
-            break;
-        case state_tx_pdu_low: // transmitting PDU [ASCII]
-tx_pdu_low:
-            {
-                // convert the low nibble of the next PDU byte to ASCII HEX
-                uint8_t ch = m_buffer[m_buffer_tx_pos] & 0xf;
-                ch = BIN2ASC(ch);
-
-                // try and write the remote station address
-                if (int ec = m_stream->write(&ch, 1))
-                {
-                    // check if something bad happened
-                    if (ec < 0)
-                    {
-                        m_state = state_exception;
-                        m_stream->communicationStatus(false, false);
-                        return 0; // fatal exception
-                    }
-
-                    // low nibble transmitted; move to the next byte in the PDU buffer
-                    m_buffer_tx_pos++;
-
-                    // check if we are finished
-                    if (m_buffer_tx_pos == m_buffer_len)
-                    {
-                        // negate the checksum (2's complement) so that everything will add to 0 at the receiving end
-                        m_checksum = (uint8_t)-(int8_t)m_checksum;
-
-                        // finished sending the PDU; now send the LRC high nibble
-                        m_state = state_tx_lrc_high;
-                        goto tx_lrc_high;
-                    }
-
-                    // low nibble of address sent; now send the high nibble of the next PDU byte
-                    m_state = state_tx_pdu_high;
-                    goto tx_pdu_high;
-                }
-
-                return 0; // waiting for room in the write buffer
-            }
-            break;
-        case state_tx_lrc_high: // transmitting LRC high [ASCII]
-tx_lrc_high:
-            {
-                // convert the high nibble of the LRC to ASCII HEX
-                uint8_t ch = m_checksum >> 4;
-                ch = BIN2ASC(ch);
-
-                // try and write the value
-                if (int ec = m_stream->write(&ch, 1))
-                {
-                    // check if something bad happened
-                    if (ec < 0)
-                    {
-                        m_state = state_exception;
-                        m_stream->communicationStatus(false, false);
-                        return 0; // fatal exception
-                    }
-
-                    // high nibble sent; now send the low nibble
-                    m_state = state_tx_lrc_low;
-                    goto tx_lrc_low;
-                }
-
-                return 0; // waiting for room in the write buffer
-            }
-            break;
-        case state_tx_lrc_low: // transmitting LRC low [ASCII]
-tx_lrc_low:
-            {
-                // convert the high nibble of the LRC to ASCII HEX
-                uint8_t ch = m_checksum & 0xf;
-                ch = BIN2ASC(ch);
-
-                // try and write the value
-                if (int ec = m_stream->write(&ch, 1))
-                {
-                    // check if something bad happened
-                    if (ec < 0)
-                    {
-                        m_state = state_exception;
-                        m_stream->communicationStatus(false, false);
-                        return 0; // fatal exception
-                    }
-
-                    // low nibble sent; now send the cr
-                    m_state = state_tx_cr;
-                    goto tx_cr;
-                }
-
-                return 0; // waiting for room in the write buffer
-            }
-            break;
-        case state_tx_cr: // transmitting carriage return character [ASCII]
-tx_cr:
-            {
-                // try and write the start of frame character
-                uint8_t ch = '\r';
-                if (int ec = m_stream->write(&ch, 1))
+                for (;;)
                 {
-                    // check if something bad happened
+                    // write what is left of the staging area
+                    int ec = tx_flush();
                     if (ec < 0)
                     {
                         m_state = state_exception;
                         m_stream->communicationStatus(false, false);
                         return 0; // fatal exception
                     }
+                    if (!ec)
+                        return 0; // waiting for room in the write buffer
 
-                    // done; move to the line feed character
-                    m_state = state_tx_lf;
-                    goto tx_lf;
-                }
-
-                return 0; // waiting for room in the write buffer
-            }
-            break;
-        case state_tx_lf: // transmitting carriage return character [ASCII]
-tx_lf:
-            {
-                // try and write the start of frame character
-                uint8_t ch = '\n';
-                if (int ec = m_stream->write(&ch, 1))
-                {
-                    // check if something bad happened
-                    if (ec < 0)
-                    {
-                        m_state = state_exception;
-                        m_stream->communicationStatus(false, false);
-                        return 0; // fatal exception
-                    }
+                    // check if the end of the frame was written
+                    if (m_state == state_tx_lrc)
+                        break;
 
-                    // done; move to the line feed character
-                    m_state = state_tx_wait;
-                    goto tx_wait;
+                    // stage the next part of the frame
+                    tx_fill(0);
                 }
 
-                return 0; // waiting for room in the write buffer
+                // done; wait for the characters to finish transmitting
+                m_state = state_tx_wait;
+                goto tx_wait;
             }
-            break;
         case state_tx_wait: // waiting for the characters to finish transmitting [ASCII]
 tx_wait:
             {
                 // dump our own echo
                 m_stream->read(NULL, (size_t)-1);
+                m_chunk_pos = m_chunk_len;
 
                 // poll if the write has completed
                 if (m_stream->writeComplete())
@@ -600,7 +509,13 @@ tx_wait:
                     goto idle;
                 }
 
-                return 0; // waiting for write buffer to drain
+                // waiting for write buffer to drain
+                //
+                // Note: most platforms have no event for the end of the
+                // transmission, so check again shortly.
+                //
+                unsigned long ticks = drain_poll_period / m_timer->microseconds_per_tick();
+                return ticks ? ticks : 1;
             }
        }
 
@@ -646,8 +561,13 @@ tx_wait:
         {
         case state_queue: // buffer is ready
             {
-                // enter the transmit start of frame state
-                m_state = state_tx_sof;
+                // stage the start of frame character and the station address, followed by as much of the PDU as fits
+                m_chunk[0] = ':';
+                encode_hex(&m_frame_address, 1, m_chunk + 1, NULL);
+                m_checksum = m_frame_address;
+                m_buffer_tx_pos = 0;
+                m_state = state_tx_pdu;
+                tx_fill(3);
                 m_stream->communicationStatus(false, true);
 
                 // enable the transmitter
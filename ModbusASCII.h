@@ -43,7 +43,16 @@ namespace ModbusPotato
             LRC_LEN = 1,
             min_pdu_length = 2, // minimum PDU length, excluding the station address. function code and one LRC byte
             default_timeout = 1000, // default timeout, in milliseconds
+            drain_poll_period = 1000, // time between checks for the end of a transmission, in microseconds
+#if defined(__AVR__)
+            chunk_size = 16, // size of the staging area for the characters received or transmitted, kept small to save RAM
+#else
+            chunk_size = 64, // size of the staging area for the characters received or transmitted
+#endif
         };
+        int rx_fill();
+        void tx_fill(size_t len);
+        int tx_flush();
         uint8_t m_checksum;
         uint8_t m_buffer_tx_pos;
         enum state_type
@@ -58,20 +67,15 @@ namespace ModbusPotato
             state_rx_pdu_high,
             state_rx_pdu_low,
             state_rx_cr,
-            state_tx_sof,
-            state_tx_addr_high,
-            state_tx_addr_low,
-            state_tx_pdu_high,
-            state_tx_pdu_low,
-            state_tx_lrc_high,
-            state_tx_lrc_low,
-            state_tx_cr,
-            state_tx_lf,
+            state_tx_pdu,
+            state_tx_lrc,
             state_tx_wait,
         };
         state_type m_state;
         system_tick_t m_last_ticks;
         system_tick_t m_T1s;
+        uint8_t m_chunk[chunk_size];
+        uint8_t m_chunk_pos, m_chunk_len;
     };
 }
 #endif
@@ -0,0 +1,61 @@
+// CRC16/MODBUS implementations for the RTU framer
+//
+// All of the functions in this file share the CModbusRTU::Crc16CalcFunc
+// signature and produce identical results; they only differ in speed and in
+// the amount of flash or RAM used for lookup tables:
+//
+//  crc16_modbus_bitwise - no table, eight shift/xor steps per byte
+//  crc16_modbus_nibble  - 16-entry table (32 bytes), two lookups per byte
+//  crc16_modbus_table   - 256-entry table (512 bytes), one lookup per byte
+//  crc16_modbus_slice4  - 4x256-entry tables (2 KiB), four bytes per step
+//  crc16_modbus_slice8  - 8x256-entry tables (4 KiB), eight bytes per step
+//  crc16_modbus_clmul   - carry-less multiply folding, 16 bytes per step
+//
+// crc16_modbus_clmul() uses the x86 PCLMULQDQ instruction when the CPU
+// supports it (checked once at run time) and falls back to
+// crc16_modbus_slice8() otherwise, including on non-x86 targets.  It is
+// intended for bulk verification of whole frames; chunks shorter than 32
+// bytes are always handed to the table implementation.
+//
+// crc16_modbus() is the implementation used by CModbusRTU when no custom
+// function is passed to CModbusRTU::setup().  It can be selected at compile
+// time by defining MODBUS_CRC16_DEFAULT to one of the MODBUS_CRC16_xxx values
+// below.
+//
+#ifndef __ModbusPotato_ModbusCRC16_h__
+#define __ModbusPotato_ModbusCRC16_h__
+#include <cstddef>
+#include "ModbusTypes.h"
+
+#define MODBUS_CRC16_BITWISE (0)
+#define MODBUS_CRC16_NIBBLE  (1)
+#define MODBUS_CRC16_TABLE   (2)
+#define MODBUS_CRC16_SLICE4  (3)
+#define MODBUS_CRC16_SLICE8  (4)
+#define MODBUS_CRC16_CLMUL   (5)
+
+#ifndef MODBUS_CRC16_DEFAULT
+#if defined(__AVR__)
+#define MODBUS_CRC16_DEFAULT MODBUS_CRC16_NIBBLE // flash is precious
+#elif defined(ARDUINO)
+#define MODBUS_CRC16_DEFAULT MODBUS_CRC16_TABLE
+#else
+#define MODBUS_CRC16_DEFAULT MODBUS_CRC16_SLICE8
+#endif
+#endif
+
+namespace ModbusPotato
+{
+
+extern uint16_t crc16_modbus (uint16_t crc, const uint8_t* buffer, size_t len);
+
+extern uint16_t crc16_modbus_bitwise (uint16_t crc, const uint8_t* buffer, size_t len);
+extern uint16_t crc16_modbus_nibble  (uint16_t crc, const uint8_t* buffer, size_t len);
+extern uint16_t crc16_modbus_table   (uint16_t crc, const uint8_t* buffer, size_t len);
+extern uint16_t crc16_modbus_slice4  (uint16_t crc, const uint8_t* buffer, size_t len);
+extern uint16_t crc16_modbus_slice8  (uint16_t crc, const uint8_t* buffer, size_t len);
+extern uint16_t crc16_modbus_clmul   (uint16_t crc, const uint8_t* buffer, size_t len);
+
+}
+
+#endif
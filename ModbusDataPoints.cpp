@@ -0,0 +1,149 @@
+#include "ModbusDataPoints.h"
+#include "ModbusUtil.h"
+namespace ModbusPotato
+{
+    CModbusDataPoints::CModbusDataPoints(const point* points, size_t n, IHandler* points_handler, IMasterHandler* handler)
+        :   m_handler(handler)
+        ,   m_points_handler(points_handler)
+        ,   m_master()
+        ,   m_points(points)
+        ,   m_n(points ? n : 0)
+        ,   m_profiles()
+        ,   m_profiles_n()
+    {
+    }
+
+    word_order::word_order CModbusDataPoints::order(uint8_t slave) const
+    {
+        for (size_t i = 0; i < m_profiles_n; ++i)
+        {
+            if (m_profiles[i].slave == slave)
+                return m_profiles[i].order;
+        }
+        return word_order::abcd;
+    }
+
+    bool CModbusDataPoints::decode(uint8_t function, uint16_t address, size_t n, const uint16_t* values, bool& found)
+    {
+        found = false;
+        if (!m_master || !m_master->current())
+            return true;
+
+        // the master knows which slave the response came from
+        uint8_t slave = m_master->current()->slave;
+        word_order::word_order wo = order(slave);
+
+        // decode every point that lies entirely within the response
+        bool ret = true;
+        unsigned long end = (unsigned long)address + n;
+        for (size_t i = 0; i < m_n; ++i)
+        {
+            const point& p = m_points[i];
+            if (p.slave != slave || p.function != function || p.address < address)
+                continue;
+            if ((unsigned long)p.address + (unsigned long)p.n * data_type_registers(p.type) > end)
+                continue;
+
+            found = true;
+            if (!decode_values(values + (p.address - address), p.n, p.type, wo, p.values))
+            {
+                ret = false;
+                continue;
+            }
+            if (m_points_handler)
+                m_points_handler->updated(&p);
+        }
+        return ret;
+    }
+
+    bool CModbusDataPoints::read_holding_registers_rsp(uint16_t address, size_t n, const uint16_t* values)
+    {
+        bool found;
+        bool ret = decode(function_code::read_holding_registers, address, n, values, found);
+        if (found)
+            return ret;
+        return m_handler ? m_handler->read_holding_registers_rsp(address, n, values) : true;
+    }
+
+    bool CModbusDataPoints::read_input_registers_rsp(uint16_t address, size_t n, const uint16_t* values)
+    {
+        bool found;
+        bool ret = decode(function_code::read_input_registers, address, n, values, found);
+        if (found)
+            return ret;
+        return m_handler ? m_handler->read_input_registers_rsp(address, n, values) : true;
+    }
+
+    bool CModbusDataPoints::read_holding_registers_block_rsp(uint16_t address, size_t n, const uint16_t* values)
+    {
+        bool found;
+        bool ret = decode(function_code::read_holding_registers, address, n, values, found);
+        if (found)
+            return ret;
+        return m_handler ? m_handler->read_holding_registers_block_rsp(address, n, values) : true;
+    }
+
+    bool CModbusDataPoints::read_input_registers_block_rsp(uint16_t address, size_t n, const uint16_t* values)
+    {
+        bool found;
+        bool ret = decode(function_code::read_input_registers, address, n, values, found);
+        if (found)
+            return ret;
+        return m_handler ? m_handler->read_input_registers_block_rsp(address, n, values) : true;
+    }
+
+    bool CModbusDataPoints::read_coils_rsp(uint16_t address, size_t n, const uint8_t* bits)
+    {
+        return m_handler ? m_handler->read_coils_rsp(address, n, bits) : true;
+    }
+
+    bool CModbusDataPoints::read_discrete_inputs_rsp(uint16_t address, size_t n, const uint8_t* bits)
+    {
+        return m_handler ? m_handler->read_discrete_inputs_rsp(address, n, bits) : true;
+    }
+
+    bool CModbusDataPoints::write_single_coil_rsp(uint16_t address, bool value)
+    {
+        return m_handler ? m_handler->write_single_coil_rsp(address, value) : true;
+    }
+
+    bool CModbusDataPoints::write_single_register_rsp(uint16_t address)
+    {
+        return m_handler ? m_handler->write_single_register_rsp(address) : true;
+    }
+
+    bool CModbusDataPoints::write_multiple_coils_rsp(uint16_t address, size_t n)
+    {
+        return m_handler ? m_handler->write_multiple_coils_rsp(address, n) : true;
+    }
+
+    bool CModbusDataPoints::write_multiple_registers_rsp(uint16_t address, size_t n)
+    {
+        return m_handler ? m_handler->write_multiple_registers_rsp(address, n) : true;
+    }
+
+    bool CModbusDataPoints::read_write_multiple_registers_rsp(uint16_t read_address, size_t read_n, const uint16_t* read_values, uint16_t write_address, size_t write_n)
+    {
+        // the registers read back are holding registers
+        bool found;
+        bool ret = decode(function_code::read_holding_registers, read_address, read_n, read_values, found);
+        if (found)
+            return ret;
+        return m_handler ? m_handler->read_write_multiple_registers_rsp(read_address, read_n, read_values, write_address, write_n) : true;
+    }
+
+    bool CModbusDataPoints::response_time_out(void)
+    {
+        return m_handler ? m_handler->response_time_out() : true;
+    }
+
+    bool CModbusDataPoints::exception_response(enum modbus_exception_code::modbus_exception_code code)
+    {
+        return m_handler ? m_handler->exception_response(code) : true;
+    }
+
+    bool CModbusDataPoints::processing_error(void)
+    {
+        return m_handler ? m_handler->processing_error() : true;
+    }
+}
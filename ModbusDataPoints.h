@@ -0,0 +1,116 @@
+#ifndef __ModbusPotato_ModbusDataPoints_h__
+#define __ModbusPotato_ModbusDataPoints_h__
+#include "ModbusMaster.h"
+namespace ModbusPotato
+{
+    /// <summary>
+    /// This class decodes register responses into arrays of typed values,
+    /// such as 32 bit floats or 64 bit counters.
+    /// </summary>
+    /// <remarks>
+    /// Each point is an array of values of one type stored in consecutive
+    /// holding or input registers of a slave.  Whenever a response covers
+    /// the whole of a point, all of its values are decoded at once using
+    /// the word order of the slave, and the points handler is told that
+    /// the point was updated.  Slaves without a profile use the word order
+    /// abcd of the Modbus specification.
+    ///
+    /// This must be the handler of the master, or the handler of the
+    /// points of a CModbusReadPlanner.  All responses that do not update a
+    /// point, and all other events, are passed on to the handler given to
+    /// the constructor, if any.
+    /// </remarks>
+    class CModbusDataPoints : public IMasterHandler
+    {
+    public:
+        /// <summary>
+        /// An array of typed values.
+        /// </summary>
+        /// <remarks>
+        /// The function must be read_holding_registers or
+        /// read_input_registers, and values must hold n values of the type.
+        /// The point takes up n times data_type_registers(type) registers.
+        /// </remarks>
+        struct point
+        {
+            uint8_t slave;
+            uint8_t function;
+            uint16_t address;
+            data_type::data_type type;
+            uint16_t n;
+            void* values;
+        };
+
+        /// <summary>
+        /// The word order used by a slave.
+        /// </summary>
+        struct profile
+        {
+            uint8_t slave;
+            word_order::word_order order;
+        };
+
+        /// <summary>
+        /// Handles data point events.
+        /// </summary>
+        class IHandler
+        {
+        public:
+            virtual ~IHandler() {}
+
+            /// <summary>
+            /// The values of a point were decoded from a response.
+            /// </summary>
+            virtual void updated(const point*) {}
+        };
+
+        CModbusDataPoints(const point* points, size_t n, IHandler* points_handler = NULL, IMasterHandler* handler = NULL);
+
+        /// <summary>
+        /// Sets the master used to send the requests.
+        /// </summary>
+        /// <remarks>
+        /// The master tells the data points which slave a response came from.
+        /// </remarks>
+        void set_master(CModbusMaster* master) { m_master = master; }
+
+        /// <summary>
+        /// Sets the word order of each slave.
+        /// </summary>
+        /// <remarks>
+        /// The array must stay valid while the data points are in use.
+        /// </remarks>
+        void set_profiles(const profile* profiles, size_t n) { m_profiles = profiles; m_profiles_n = profiles ? n : 0; }
+
+        /// <summary>
+        /// Returns the word order of a slave.
+        /// </summary>
+        word_order::word_order order(uint8_t slave) const;
+
+        bool read_coils_rsp(uint16_t address, size_t n, const uint8_t* bits) override;
+        bool read_discrete_inputs_rsp(uint16_t address, size_t n, const uint8_t* bits) override;
+        bool read_holding_registers_rsp(uint16_t address, size_t n, const uint16_t* values) override;
+        bool read_input_registers_rsp(uint16_t address, size_t n, const uint16_t* values) override;
+        bool read_holding_registers_block_rsp(uint16_t address, size_t n, const uint16_t* values) override;
+        bool read_input_registers_block_rsp(uint16_t address, size_t n, const uint16_t* values) override;
+        bool write_single_coil_rsp(uint16_t address, bool value) override;
+        bool write_single_register_rsp(uint16_t address) override;
+        bool write_multiple_coils_rsp(uint16_t address, size_t n) override;
+        bool write_multiple_registers_rsp(uint16_t address, size_t n) override;
+        bool read_write_multiple_registers_rsp(uint16_t read_address, size_t read_n, const uint16_t* read_values, uint16_t write_address, size_t write_n) override;
+        bool response_time_out(void) override;
+        bool exception_response(enum modbus_exception_code::modbus_exception_code code) override;
+        bool processing_error(void) override;
+    private:
+        bool decode(uint8_t function, uint16_t address, size_t n, const uint16_t* values, bool& found);
+
+        IMasterHandler* m_handler;
+        IHandler* m_points_handler;
+        CModbusMaster* m_master;
+        const point* m_points;
+        size_t m_n;
+        const profile* m_profiles;
+        size_t m_profiles_n;
+    };
+}
+#endif
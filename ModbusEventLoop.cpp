@@ -0,0 +1,205 @@
+#include "ModbusEventLoop.h"
+#ifdef __linux__
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+namespace ModbusPotato
+{
+    // returns the time of the clock used by the timerfd, in nanoseconds
+    static uint64_t monotonic_ns()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+    }
+
+    CModbusEventLoop::CModbusEventLoop(ITimeProvider* timer)
+        :   m_timer(timer)
+        ,   m_entries()
+        ,   m_n()
+        ,   m_epoll_fd(-1)
+        ,   m_timer_fd(-1)
+    {
+    }
+
+    CModbusEventLoop::~CModbusEventLoop()
+    {
+        close();
+    }
+
+    bool CModbusEventLoop::open()
+    {
+        m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (m_epoll_fd < 0)
+            return false;
+
+        m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (m_timer_fd < 0)
+        {
+            int err = errno;
+            close();
+            errno = err;
+            return false;
+        }
+
+        epoll_event ev = epoll_event();
+        ev.events = EPOLLIN;
+        ev.data.fd = m_timer_fd;
+        if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_timer_fd, &ev) < 0)
+        {
+            int err = errno;
+            close();
+            errno = err;
+            return false;
+        }
+        return true;
+    }
+
+    void CModbusEventLoop::close()
+    {
+        if (m_timer_fd >= 0)
+        {
+            ::close(m_timer_fd);
+            m_timer_fd = -1;
+        }
+        if (m_epoll_fd >= 0)
+        {
+            ::close(m_epoll_fd);
+            m_epoll_fd = -1;
+        }
+    }
+
+    bool CModbusEventLoop::add(IFramer* framer, int fd)
+    {
+        if (!framer || fd < 0)
+        {
+            errno = EINVAL;
+            return false;
+        }
+        if (m_n >= max_framers)
+        {
+            errno = ENOSPC;
+            return false;
+        }
+        if (m_epoll_fd < 0 && !open())
+            return false;
+
+        // the descriptor is edge-triggered, as each event is followed by a call to poll()
+        epoll_event ev = epoll_event();
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.fd = fd;
+        if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+            return false;
+
+        // poll it on the next call to poll()
+        entry& e = m_entries[m_n++];
+        e.framer = framer;
+        e.fd = fd;
+        e.ready = true;
+        e.armed = false;
+        e.deadline = 0;
+        return true;
+    }
+
+    void CModbusEventLoop::remove(IFramer* framer)
+    {
+        for (size_t i = 0; i < m_n; ++i)
+        {
+            if (m_entries[i].framer != framer)
+                continue;
+
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, m_entries[i].fd, NULL);
+            for (--m_n; i < m_n; ++i)
+                m_entries[i] = m_entries[i + 1];
+            arm_timer();
+            return;
+        }
+    }
+
+    int CModbusEventLoop::poll(int timeout)
+    {
+        if (m_epoll_fd < 0)
+        {
+            errno = EBADF;
+            return -1;
+        }
+
+        // pick up any changes made since the last call
+        for (size_t i = 0; i < m_n; ++i)
+            poll_framer(&m_entries[i]);
+        if (!arm_timer())
+            return -1;
+
+        // wait for a descriptor or the timer
+        epoll_event events[max_framers + 1];
+        int ec = epoll_wait(m_epoll_fd, events, max_framers + 1, timeout);
+        if (ec < 0)
+            return errno == EINTR ? 0 : -1;
+
+        for (int i = 0; i < ec; ++i)
+        {
+            int fd = events[i].data.fd;
+            if (fd == m_timer_fd)
+            {
+                // acknowledge the expiration; the deadlines are checked below
+                uint64_t expirations;
+                if (read(m_timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+                    return -1;
+                continue;
+            }
+            for (size_t j = 0; j < m_n; ++j)
+            {
+                if (m_entries[j].fd == fd)
+                    m_entries[j].ready = true;
+            }
+        }
+
+        // poll the framers that have an event or whose timeout has expired
+        int count = 0;
+        uint64_t now = monotonic_ns();
+        for (size_t i = 0; i < m_n; ++i)
+        {
+            entry* e = &m_entries[i];
+            if (!e->ready && !(e->armed && e->deadline <= now))
+                continue;
+            poll_framer(e);
+            ++count;
+        }
+        if (!arm_timer())
+            return -1;
+
+        return count;
+    }
+
+    void CModbusEventLoop::poll_framer(entry* e)
+    {
+        e->ready = false;
+
+        // convert the timeout to a deadline; 0 means wait for an event
+        unsigned long ticks = e->framer->poll();
+        e->armed = ticks != 0;
+        if (e->armed)
+            e->deadline = monotonic_ns() + (uint64_t)ticks * m_timer->microseconds_per_tick() * 1000u;
+    }
+
+    bool CModbusEventLoop::arm_timer()
+    {
+        // find the earliest deadline
+        uint64_t deadline = 0;
+        for (size_t i = 0; i < m_n; ++i)
+        {
+            const entry& e = m_entries[i];
+            if (e.armed && (!deadline || e.deadline < deadline))
+                deadline = e.deadline;
+        }
+
+        // an all zero value disarms the timer
+        itimerspec spec = itimerspec();
+        spec.it_value.tv_sec = (time_t)(deadline / 1000000000u);
+        spec.it_value.tv_nsec = (long)(deadline % 1000000000u);
+        return timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == 0;
+    }
+}
+#endif
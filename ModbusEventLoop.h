@@ -0,0 +1,98 @@
+#ifndef __ModbusEventLoop_h__
+#define __ModbusEventLoop_h__
+#include "ModbusInterface.h"
+#ifdef __linux__
+namespace ModbusPotato
+{
+    /// <summary>
+    /// This class drives the poll() method of one or more framers from a
+    /// single epoll loop, so that the process sleeps while there is nothing
+    /// to do.
+    /// </summary>
+    /// <remarks>
+    /// The file descriptor of each framer's stream (such as the fd() of a
+    /// CModbusPosixSerial instance) is registered edge-triggered for input
+    /// and output, and a timerfd is armed for the earliest timeout returned
+    /// by the poll() method of the framers.  A framer is polled when its
+    /// descriptor becomes ready or its timeout expires, and the timer is
+    /// then re-armed from the new timeout, so the T1.5 and T3.5 delays are
+    /// timed by the kernel instead of a busy loop.
+    ///
+    /// Every framer is also polled once at the start of each call to poll(),
+    /// which picks up any change of state made by the application, such as
+    /// a request sent by a CModbusMaster, since the previous call.
+    ///
+    /// The time provider must be the one used by the framers; it is only
+    /// used to convert the timeouts from ticks to microseconds.
+    /// </remarks>
+    class CModbusEventLoop
+    {
+    public:
+        enum
+        {
+            max_framers = 8, // maximum number of framers per loop
+        };
+
+        CModbusEventLoop(ITimeProvider* timer);
+        ~CModbusEventLoop();
+
+        /// <summary>
+        /// Adds a framer along with the file descriptor of its stream.
+        /// </summary>
+        /// <returns>
+        /// true if successful, or false if the loop is full or the
+        /// descriptor could not be registered, in which case errno is set.
+        /// </returns>
+        bool add(IFramer* framer, int fd);
+
+        /// <summary>
+        /// Removes a framer from the loop.
+        /// </summary>
+        void remove(IFramer* framer);
+
+        /// <summary>
+        /// Polls the framers, then waits for and handles their events.
+        /// </summary>
+        /// <returns>
+        /// The number of framers polled because of an event or a timeout,
+        /// or -1 on error, in which case errno is set.
+        /// </returns>
+        /// <remarks>
+        /// The timeout is in milliseconds; -1 waits until a framer needs
+        /// attention and 0 returns immediately.  A finite timeout can be used
+        /// to also poll other objects, such as a CModbusMaster, from the same
+        /// loop.
+        /// </remarks>
+        int poll(int timeout);
+
+        /// <summary>
+        /// Returns the epoll file descriptor, or -1 if no framer was added.
+        /// </summary>
+        /// <remarks>
+        /// The descriptor becomes readable when poll() has work to do, so it
+        /// can be nested inside another event loop.
+        /// </remarks>
+        int fd() const { return m_epoll_fd; }
+    private:
+        struct entry
+        {
+            IFramer* framer;
+            int fd;
+            bool ready;          // the descriptor had an event
+            bool armed;          // the framer is waiting for a timeout
+            uint64_t deadline;   // end of the timeout, in CLOCK_MONOTONIC nanoseconds
+        };
+        CModbusEventLoop(const CModbusEventLoop&);
+        CModbusEventLoop& operator=(const CModbusEventLoop&);
+        bool open();
+        void close();
+        void poll_framer(entry* e);
+        bool arm_timer();
+        ITimeProvider* m_timer;
+        entry m_entries[max_framers];
+        size_t m_n;
+        int m_epoll_fd, m_timer_fd;
+    };
+}
+#endif
+#endif
@@ -24,6 +24,10 @@ namespace ModbusPotato
 #endif
 #endif
 
+    // convert a register between the host and the big-endian PDU byte order
+    static inline uint16_t hton_register(uint16_t value) { uint16_t result; uint8_t* p = (uint8_t*)&result; p[0] = (uint8_t)(value >> 8); p[1] = (uint8_t)value; return result; }
+    static inline uint16_t ntoh_register(uint16_t value) { const uint8_t* p = (const uint8_t*)&value; return (uint16_t)((p[0] << 8) | p[1]); }
+
     // forward declarations
     class IFramer;
 
@@ -70,6 +74,45 @@ namespace ModbusPotato
         /// </remarks>
         virtual int write(uint8_t* buffer, size_t len) = 0;
 
+        /// <summary>
+        /// A buffer passed to writev().
+        /// </summary>
+        struct segment
+        {
+            uint8_t* buffer;
+            size_t len;
+        };
+
+        /// <summary>
+        /// Sends the characters of several buffers, in order, without blocking.
+        /// </summary>
+        /// <returns>
+        /// The total number of characters written, or -1 if communications exception.
+        /// </returns>
+        /// <remarks>
+        /// The default implementation calls write() for each buffer in turn,
+        /// and stops at the first one that is not completely written.  A
+        /// driver that can queue several buffers in a single call, such as
+        /// with writev() on POSIX systems, should override this so that a
+        /// frame is handed over at once instead of in pieces.
+        /// </remarks>
+        virtual int writev(const segment* segments, size_t count)
+        {
+            int total = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (!segments[i].len)
+                    continue;
+                int ec = write(segments[i].buffer, segments[i].len);
+                if (ec < 0)
+                    return ec;
+                total += ec;
+                if ((size_t)ec != segments[i].len)
+                    break;
+            }
+            return total;
+        }
+
         /// <summary>
         /// Enables or disables the RS-485 transmitter.
         /// </summary>
@@ -84,6 +127,22 @@ namespace ModbusPotato
         /// </summary>
         virtual bool writeComplete() = 0;
 
+        /// <summary>
+        /// Indicates if the driver switches the RS-485 transceiver direction by itself.
+        /// </summary>
+        /// <remarks>
+        /// When this returns true, the framer does not call txEnable(false)
+        /// after sending a frame.  It still waits for writeComplete() and
+        /// then for the inter-frame delay, since the turnaround delay of the
+        /// master is counted from when a request is queued rather than from
+        /// when its last character leaves the wire, and so cannot be relied
+        /// on to separate a long broadcast from the next frame.
+        ///
+        /// This should only return true if the driver releases the bus as
+        /// soon as the last character has been sent.
+        /// </remarks>
+        virtual bool txAutoTurnaround() { return false; }
+
         /// <summary>
         /// Provides the user some indication that a frame is being sent or received.
         /// </summary>
@@ -383,6 +442,23 @@ namespace ModbusPotato
     public:
         virtual ~ISlaveHandler() {}
 
+        /// <summary>
+        /// Returns true if the handler reads and writes register values in
+        /// the big-endian byte order of the PDU.
+        /// </summary>
+        /// <remarks>
+        /// By default, the values passed to the register functions are
+        /// converted to and from the byte order of the host.  A handler that
+        /// returns true gets the values exactly as they are in the frame,
+        /// which saves the conversion when they are simply copied.  This
+        /// applies to the arrays of registers only; the single values passed
+        /// to write_single_register() and mask_write_register() are always
+        /// in the host byte order.
+        /// </remarks>
+        virtual bool big_endian_registers() const {
+            return false;
+        }
+
         /// <summary>
         /// Handles Modbus function 0x01: Read Coils.
         /// </summary>
@@ -456,6 +532,8 @@ namespace ModbusPotato
          * @return Modbus exception code, if any
          */
         virtual modbus_exception_code::modbus_exception_code write_single_register(uint16_t address, uint16_t value) {
+            if (big_endian_registers())
+                value = hton_register(value);
             return write_multiple_registers(address, 1, &value);
         }
 
@@ -484,6 +562,86 @@ namespace ModbusPotato
         virtual modbus_exception_code::modbus_exception_code write_multiple_registers(uint16_t, uint16_t, const uint16_t*) {
             return modbus_exception_code::illegal_function;
         }
+
+        /// <summary>
+        /// Handles Modbus function 0x16: Mask Write Register.
+        /// </summary>
+        /// <remarks>
+        /// The register is set to (value AND and_mask) OR (or_mask AND NOT
+        /// and_mask).  By default, the register is read with
+        /// read_holding_registers() and written back with
+        /// write_single_register(); override this if the change must be
+        /// atomic.
+        /// </remarks>
+        /**
+         * @param address   register address
+         * @param and_mask  bits to keep
+         * @param or_mask   bits to set among the ones not kept
+         * @return Modbus exception code, if any
+         */
+        virtual modbus_exception_code::modbus_exception_code mask_write_register(uint16_t address, uint16_t and_mask, uint16_t or_mask) {
+            uint16_t value;
+            if (modbus_exception_code::modbus_exception_code result = read_holding_registers(address, 1, &value))
+                return result;
+            if (big_endian_registers())
+                value = ntoh_register(value);
+            return write_single_register(address, (value & and_mask) | (or_mask & ~and_mask));
+        }
+
+        /// <summary>
+        /// Handles Modbus function 0x17: Read/Write Multiple registers.
+        /// </summary>
+        /// <remarks>
+        /// The write must be done before the read.  The read values share
+        /// the frame buffer with the write values, so nothing may be stored
+        /// in read_values until all of write_values have been used.  By
+        /// default, write_multiple_registers() is called followed by
+        /// read_holding_registers(); override this if the transaction must
+        /// be atomic.
+        /// </remarks>
+        /**
+         * @param read_address   read start address
+         * @param read_n         number of registers to read
+         * @param read_values    values to store
+         * @param write_address  write start address
+         * @param write_n        number of registers to write
+         * @param write_values   values to write
+         * @return Modbus exception code, if any
+         */
+        virtual modbus_exception_code::modbus_exception_code read_write_multiple_registers(uint16_t read_address, uint16_t read_n, uint16_t* read_values, uint16_t write_address, uint16_t write_n, const uint16_t* write_values) {
+            if (modbus_exception_code::modbus_exception_code result = write_multiple_registers(write_address, write_n, write_values))
+                return result;
+            return read_holding_registers(read_address, read_n, read_values);
+        }
+    };
+
+    /// <summary>
+    /// Handles a Modbus function code in place of, or in addition to, the
+    /// ones built into CModbusSlave.
+    /// </summary>
+    class IFunctionHandler
+    {
+    public:
+        virtual ~IFunctionHandler() {}
+
+        /// <summary>
+        /// Executes the request in the buffer of the framer.
+        /// </summary>
+        /// <returns>
+        /// The Modbus exception code, if any.
+        /// </returns>
+        /// <remarks>
+        /// The buffer holds the request PDU, starting with the function
+        /// code, and buffer_len() is its length.  If successful, the buffer
+        /// must be filled in with the response PDU, up to buffer_max()
+        /// bytes, and its length set with set_buffer_len().  The response is
+        /// not sent for broadcast requests.
+        ///
+        /// The slave handler is passed along so that the request can be
+        /// applied to the same data as the built-in functions; it may be
+        /// NULL.
+        /// </remarks>
+        virtual uint8_t execute(IFramer* framer, ISlaveHandler* handler) = 0;
     };
 
     /// <summary>
@@ -494,25 +652,48 @@ namespace ModbusPotato
     public:
         virtual ~IMasterHandler() {}
 
+        /// <summary>
+        /// Returns true if the handler receives register values in the
+        /// big-endian byte order of the PDU.
+        /// </summary>
+        /// <remarks>
+        /// By default, the registers passed to the response functions are
+        /// converted to the byte order of the host.
+        /// </remarks>
+        virtual bool big_endian_registers() const {
+            return false;
+        }
+
         /// <summary>
         /// Handles Modbus function 0x01: Read Coils.
         /// </summary>
+        /// <remarks>
+        /// The coils are packed 8 to a byte, with the first coil in the
+        /// least significant bit of the first byte; see unpack_bits().
+        /// </remarks>
         /**
-         * @param framer  frame handler
+         * @param address  coil start address
+         * @param n        number of coils
+         * @param bits     packed coil values
          * @return true, when successful, false otherwise
          */
-        virtual bool read_coils_rsp(IFramer*) {
+        virtual bool read_coils_rsp(uint16_t, size_t, const uint8_t*) {
             return true;
         }
 
         /// <summary>
         /// Handles Modbus function 0x02: Read Discrete Inputs.
         /// </summary>
+        /// <remarks>
+        /// The inputs are packed in the same way as for read_coils_rsp().
+        /// </remarks>
         /**
-         * @param framer  frame handler
+         * @param address  input start address
+         * @param n        number of inputs
+         * @param bits     packed input values
          * @return true, when successful, false otherwise
          */
-        virtual bool read_discrete_inputs_rsp(IFramer*) {
+        virtual bool read_discrete_inputs_rsp(uint16_t, size_t, const uint8_t*) {
             return true;
         }
 
@@ -542,14 +723,41 @@ namespace ModbusPotato
             return true;
         }
 
+        /// <summary>
+        /// Handles the completion of a block read of holding registers.
+        /// </summary>
+        /**
+         * @param address  register start address
+         * @param n        number of registers
+         * @param values   values read, in the buffer given to the request
+         * @return true, when successful, false otherwise
+         */
+        virtual bool read_holding_registers_block_rsp(uint16_t, size_t, const uint16_t*) {
+            return true;
+        }
+
+        /// <summary>
+        /// Handles the completion of a block read of input registers.
+        /// </summary>
+        /**
+         * @param address  register start address
+         * @param n        number of registers
+         * @param values   values read, in the buffer given to the request
+         * @return true, when successful, false otherwise
+         */
+        virtual bool read_input_registers_block_rsp(uint16_t, size_t, const uint16_t*) {
+            return true;
+        }
+
         /// <summary>
         /// Handles Modbus function 0x05: Write Single Coil.
         /// </summary>
         /**
-         * @param framer  frame handler
+         * @param address  coil address
+         * @param value    value written
          * @return true, when successful, false otherwise
          */
-        virtual bool write_single_coil_rsp(IFramer*) {
+        virtual bool write_single_coil_rsp(uint16_t, bool) {
             return true;
         }
 
@@ -568,10 +776,11 @@ namespace ModbusPotato
         /// Handles Modbus function 0x0F: Write Multiple Coils.
         /// </summary>
         /**
-         * @param framer  frame handler
+         * @param address  coil start address
+         * @param n        number of coils
          * @return true, when successful, false otherwise
          */
-        virtual bool write_multiple_coils_rsp(IFramer*) {
+        virtual bool write_multiple_coils_rsp(uint16_t, size_t) {
             return true;
         }
 
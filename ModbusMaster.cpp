@@ -1,4 +1,6 @@
+#include <string.h>
 #include "ModbusMaster.h"
+#include "ModbusTCP.h"
 #include "ModbusUtil.h"
 
 namespace ModbusPotato
@@ -8,11 +10,18 @@ namespace ModbusPotato
         ,   m_framer(framer)
         ,   m_time_provider(timer)
         ,   m_state(state::idle)
-        ,   m_timer()
-        ,   m_slave_address()
-        ,   m_read_starting_address()
-        ,   m_write_starting_address()
-        ,   m_write_n()
+        ,   m_tcp()
+        ,   m_transactions(&m_transaction)
+        ,   m_depth(1)
+        ,   m_transaction()
+        ,   m_current(&m_transaction)
+        ,   m_block_buffer()
+        ,   m_block_function(function_code::read_holding_registers)
+        ,   m_block_slave()
+        ,   m_block_address()
+        ,   m_block_n()
+        ,   m_block_sent()
+        ,   m_block_left()
     {
          m_response_time_out = response_time_out * 1000
                              / m_time_provider->microseconds_per_tick();
@@ -20,24 +29,102 @@ namespace ModbusPotato
                              / m_time_provider->microseconds_per_tick();
     }
 
+    CModbusMaster::CModbusMaster(IMasterHandler* handler, CModbusTCP* framer, ITimeProvider* timer, transaction* transactions, size_t depth, unsigned int response_time_out)
+        :   m_handler(handler)
+        ,   m_framer(framer)
+        ,   m_time_provider(timer)
+        ,   m_turnaround_delay()
+        ,   m_state(state::idle)
+        ,   m_tcp(framer)
+        ,   m_transactions(transactions)
+        ,   m_depth(transactions ? depth : 0)
+        ,   m_transaction()
+        ,   m_current()
+        ,   m_block_buffer()
+        ,   m_block_function(function_code::read_holding_registers)
+        ,   m_block_slave()
+        ,   m_block_address()
+        ,   m_block_n()
+        ,   m_block_sent()
+        ,   m_block_left()
+    {
+         m_response_time_out = response_time_out * 1000
+                             / m_time_provider->microseconds_per_tick();
+
+         for (size_t i = 0; i < m_depth; ++i)
+             m_transactions[i].pending = false;
+    }
+
+    size_t CModbusMaster::pending() const
+    {
+        if (!m_tcp)
+        {
+            return (m_state == state::waiting_for_reply)
+                 ? 1
+                 : 0;
+        }
+
+        size_t n = 0;
+        for (size_t i = 0; i < m_depth; ++i)
+        {
+            if (m_transactions[i].pending)
+                n++;
+        }
+        return n;
+    }
+
     void CModbusMaster::poll (void)
     {
+        if (m_tcp)
+        {
+            // check the time out of each outstanding request
+            if (m_state != state::idle)
+                return;
+            for (size_t i = 0; i < m_depth; ++i)
+            {
+                transaction* t = &m_transactions[i];
+                if (!t->pending || m_time_provider->ticks() - t->timer <= m_response_time_out)
+                    continue;
+
+                // free the slot; a late response will be ignored
+                t->pending = false;
+                m_current = t;
+                bool ret = m_handler->response_time_out();
+                if (t->block)
+                    abort_block();
+                if (!ret)
+                {
+                    m_state = state::processing_error;
+                    return;
+                }
+            }
+
+            // keep the pipeline full
+            if (m_block_buffer)
+                send_block();
+            return;
+        }
+
         switch (m_state)
         {
             case state::idle:
             default:
+                if (m_block_buffer)
+                    send_block();
                 break;
             case state::waiting_for_reply:
-                if (m_time_provider->ticks() - m_timer <= m_response_time_out)
+                if (m_time_provider->ticks() - m_transaction.timer <= m_response_time_out)
                     break;
                 m_state = m_handler->response_time_out()
                         ? state::idle
                         : state::processing_error;
+                if (m_transaction.block)
+                    abort_block();
                 break;
             case state::processing_reply:
                 break;
             case state::waiting_turnaround_reply:
-                if (m_time_provider->ticks() - m_timer >= m_turnaround_delay)
+                if (m_time_provider->ticks() - m_transaction.timer >= m_turnaround_delay)
                     m_state = state::idle;
                 break;
             case state::processing_error:
@@ -45,26 +132,6 @@ namespace ModbusPotato
         }
     }
 
-    bool CModbusMaster::read_coils_req(void)
-    {
-        return false;
-    }
-
-    bool CModbusMaster::read_discrete_inputs_req(void)
-    {
-        return false;
-    }
-
-    bool CModbusMaster::write_single_coil_req(void)
-    {
-        return false;
-    }
-
-    bool CModbusMaster::write_multiple_coils_req(void)
-    {
-        return false;
-    }
-
     void CModbusMaster::frame_ready(IFramer* framer)
     {
         bool ret = false;
@@ -72,25 +139,18 @@ namespace ModbusPotato
         // sanity checks
         if (framer->buffer_len() == 0)
             goto finish;
-        if (m_state != state::waiting_for_reply)
-            goto finish;
-
-        // unexpected slave
-        if (framer->frame_address() != m_slave_address)
-        {
-            m_timer = m_time_provider->ticks();
+        if (!find_transaction(framer))
             goto finish;
-        }
 
         // handle the function code
         m_state = state::processing_reply;
         switch (framer->buffer()[0])
         {
         case function_code::read_coil_status:
-            ret = m_handler->read_coils_rsp(framer);
+            ret = read_bits_rsp(framer, function_code::read_coil_status);
             break;
         case function_code::read_discrete_input_status:
-            m_handler->read_discrete_inputs_rsp(framer);
+            ret = read_bits_rsp(framer, function_code::read_discrete_input_status);
             break;
         case function_code::read_holding_registers:
             ret = read_registers_rsp(framer, function_code::read_holding_registers);
@@ -99,13 +159,13 @@ namespace ModbusPotato
             ret = read_registers_rsp(framer, function_code::read_input_registers);
             break;
         case function_code::write_single_coil:
-            ret = m_handler->write_single_coil_rsp(framer);
+            ret = write_coils_rsp(framer, true);
             break;
         case function_code::write_single_register:
             ret = write_registers_rsp(framer, true);
             break;
         case function_code::write_multiple_coils:
-            ret = m_handler->write_multiple_coils_rsp(framer);
+            ret = write_coils_rsp(framer, false);
             break;
         case function_code::write_multiple_registers:
             ret = write_registers_rsp(framer, false);
@@ -123,12 +183,156 @@ namespace ModbusPotato
         }
 
         if (ret == false)
+        {
+            if (m_current->block)
+                abort_block();
             ret = m_handler->processing_error();
+        }
 
         m_state = (ret == true) ? state::idle : state::processing_error;
 
     finish:
         framer->finished();
+
+        // request the next part of a block read right away
+        if (m_block_buffer)
+            send_block();
+    }
+
+    bool CModbusMaster::read_bits_req(const enum function_code::function_code func, const uint8_t slave, const uint16_t address, const uint16_t n)
+    {
+        const size_t len = pdu_len_req(func) - PDU_LEN_CRC;
+
+        if (!sanity_check(n, 0x7d0, len))
+            return false;
+
+        // make request frame
+        m_framer->set_frame_address(slave);
+        uint8_t* buffer = m_framer->buffer();
+        *buffer++ = (uint8_t) func;
+        *buffer++ = (uint8_t) (address >> 8);
+        *buffer++ = (uint8_t) (address >> 0);
+        *buffer++ = (uint8_t) (n >> 8);
+        *buffer++ = (uint8_t) (n >> 0);
+
+        m_current->read_starting_address = address;
+        m_current->read_n = n;
+        send_and_wait(slave, len);
+        return true;
+    }
+
+    bool CModbusMaster::read_bits_rsp(IFramer* framer, const enum function_code::function_code func)
+    {
+        const uint8_t* buffer = framer->buffer();
+        (void)          *buffer++;      // function code
+        uint8_t count = *buffer++;      // byte count
+
+        // the byte count does not give the exact number of bits, so use the request
+        const size_t n = m_current->read_n;
+        if (count != packed_bits_len(n) || framer->buffer_len() < (size_t)2 + count)
+            return false;
+
+        // the bits are passed on as they are packed in the frame
+        if (func == function_code::read_discrete_input_status)
+            return m_handler->read_discrete_inputs_rsp(m_current->read_starting_address, n, buffer);
+        return m_handler->read_coils_rsp(m_current->read_starting_address, n, buffer);
+    }
+
+    bool CModbusMaster::write_single_coil_req(const uint8_t slave, const uint16_t address, const bool value)
+    {
+        const size_t len = pdu_len_req(function_code::write_single_coil) - PDU_LEN_CRC;
+
+        if (!sanity_check(1, 1, len))
+            return false;
+
+        // make request frame
+        m_framer->set_frame_address(slave);
+        uint8_t* buffer = m_framer->buffer();
+        *buffer++ = (uint8_t) function_code::write_single_coil;
+        *buffer++ = (uint8_t) (address >> 8);
+        *buffer++ = (uint8_t) address;
+        *buffer++ = value ? 0xff : 0x00;
+        *buffer++ = 0x00;
+
+        m_current->write_starting_address = address;
+        send_and_wait(slave, len);
+        return true;
+    }
+
+    bool CModbusMaster::write_multiple_coils_req(const uint8_t slave, const uint16_t address, const size_t n, const uint8_t* bits)
+    {
+        uint8_t* buffer = write_coils_req(slave, address, n);
+        if (!buffer)
+            return false;
+
+        // copy the packed bits; any unused bits of the last byte must be 0
+        const size_t count = packed_bits_len(n);
+        memcpy(buffer, bits, count);
+        if (n % 8)
+            buffer[count - 1] &= (uint8_t) ((1 << n % 8) - 1);
+
+        send_and_wait(slave, pdu_len_req(function_code::write_multiple_coils, count) - PDU_LEN_CRC);
+        return true;
+    }
+
+    bool CModbusMaster::write_multiple_coils_req(const uint8_t slave, const uint16_t address, const size_t n, const bool values[])
+    {
+        uint8_t* buffer = write_coils_req(slave, address, n);
+        if (!buffer)
+            return false;
+
+        // pack the values straight into the frame
+        pack_bits(values, n, buffer);
+
+        send_and_wait(slave, pdu_len_req(function_code::write_multiple_coils, packed_bits_len(n)) - PDU_LEN_CRC);
+        return true;
+    }
+
+    uint8_t* CModbusMaster::write_coils_req(const uint8_t slave, const uint16_t address, const size_t n)
+    {
+        const size_t count = packed_bits_len(n);
+        const size_t len = pdu_len_req(function_code::write_multiple_coils, count) - PDU_LEN_CRC;
+
+        if (!sanity_check(n, 0x7b0, len))
+            return NULL;
+
+        // make request frame, up to the coil values
+        m_framer->set_frame_address(slave);
+        uint8_t* buffer = m_framer->buffer();
+        *buffer++ = (uint8_t) function_code::write_multiple_coils;
+        *buffer++ = (uint8_t) (address >> 8);
+        *buffer++ = (uint8_t) address;
+        *buffer++ = (uint8_t) (n >> 8);
+        *buffer++ = (uint8_t) n;
+        *buffer++ = (uint8_t) count;
+
+        m_current->write_starting_address = address;
+        m_current->write_n = (uint16_t) n;
+        return buffer;
+    }
+
+    bool CModbusMaster::write_coils_rsp(IFramer* framer, bool single)
+    {
+        uint8_t* buffer = framer->buffer();
+        (void)                         *buffer++;       // function code
+        uint16_t address = (uint16_t) (*buffer++ << 8); // starting address
+                 address|= (uint16_t) (*buffer++ << 0); //
+        uint16_t value   = (uint16_t) (*buffer++ << 8); // output value or quantity of outputs
+                 value  |= (uint16_t) (*buffer++ << 0); //
+
+        if (single)
+        {
+            if (value != 0xff00 && value != 0x0000)
+                return false;
+
+            return m_handler->write_single_coil_rsp(address, value != 0);
+        }
+        else {
+            if ((value < 1) || (value > 0x7b0))
+                return false;
+
+            return m_handler->write_multiple_coils_rsp(address, value);
+        }
     }
 
     bool CModbusMaster::read_registers_req(const enum function_code::function_code func, const uint8_t slave, const uint16_t address, const uint16_t n)
@@ -147,7 +351,8 @@ namespace ModbusPotato
         *buffer++ = (uint8_t) (n >> 8);
         *buffer++ = (uint8_t) (n >> 0);
 
-        m_read_starting_address = address;
+        m_current->read_starting_address = address;
+        m_current->read_n = n;
         send_and_wait(slave, len);
         return true;
     }
@@ -164,30 +369,110 @@ namespace ModbusPotato
             return false;
 
         count /= 2;
-        uint16_t *const data = (uint16_t*) buffer;
+        if (m_current->block)
+            return read_registers_block_rsp(buffer, count);
 
-        if (ntohs(0x00ffu) != 0x00ffu)
-        {
-            for (int i = 0; i < count; ++i)
-                data[i] = ntohs(data[i]);
-        }
+        uint16_t *const data = registers_from_pdu(buffer, count, !m_handler->big_endian_registers());
 
         switch (func)
         {
         case function_code::read_holding_registers:
-            return m_handler->read_holding_registers_rsp(m_read_starting_address, count, data);
+            return m_handler->read_holding_registers_rsp(m_current->read_starting_address, count, data);
             break;
         case function_code::read_input_registers:
-            return m_handler->read_input_registers_rsp(m_read_starting_address, count, data);
+            return m_handler->read_input_registers_rsp(m_current->read_starting_address, count, data);
             break;
         case function_code::read_write_multiple_registers:
-            return m_handler->read_write_multiple_registers_rsp(m_read_starting_address, count, data, m_write_starting_address, m_write_n);
+            return m_handler->read_write_multiple_registers_rsp(m_current->read_starting_address, count, data, m_current->write_starting_address, m_current->write_n);
             break;
         default:
             return false;
         }
     }
 
+    bool CModbusMaster::read_registers_block_req(const enum function_code::function_code func, const uint8_t slave, const uint16_t address, const size_t n, uint16_t* buffer)
+    {
+        if (m_block_buffer || !buffer)
+            return false;
+        if ((n < 1) || ((size_t)address + n > 0x10000))
+            return false;
+        if (!slave && !m_tcp)
+            return false; // broadcasts are not answered
+
+        m_block_buffer   = buffer;
+        m_block_function = func;
+        m_block_slave    = slave;
+        m_block_address  = address;
+        m_block_n        = n;
+        m_block_sent     = 0;
+        m_block_left     = n;
+
+        // from a response callback, the first request is sent by frame_ready() once the response has been handled
+        if (m_state == state::processing_reply)
+            return true;
+
+        // send the first request
+        send_block();
+        if (!m_block_sent)
+        {
+            m_block_buffer = NULL;
+            return false; // busy
+        }
+        return true;
+    }
+
+    bool CModbusMaster::read_registers_block_rsp(const uint8_t* buffer, size_t count)
+    {
+        // the slave must return exactly what was asked for
+        if (count != m_current->read_n)
+            return false;
+
+        // store the values straight into the caller's buffer
+        uint16_t* data = m_block_buffer + (m_current->read_starting_address - m_block_address);
+        if (m_handler->big_endian_registers())
+            memcpy(data, buffer, 2 * count);
+        else
+            convert_registers(data, buffer, count);
+
+        m_block_left -= count;
+        if (m_block_left)
+            return true; // more to come
+
+        // done; the block is released before the callback so that another one can be started from it
+        uint16_t* values = m_block_buffer;
+        m_block_buffer = NULL;
+        if (m_block_function == function_code::read_input_registers)
+            return m_handler->read_input_registers_block_rsp(m_block_address, m_block_n, values);
+        return m_handler->read_holding_registers_block_rsp(m_block_address, m_block_n, values);
+    }
+
+    void CModbusMaster::send_block(void)
+    {
+        // request as many parts as the master will take; one at a time on a serial line
+        while (m_block_sent < m_block_n)
+        {
+            size_t n = m_block_n - m_block_sent;
+            if (n > 0x7d)
+                n = 0x7d;
+            if (!read_registers_req(m_block_function, m_block_slave, (uint16_t)(m_block_address + m_block_sent), (uint16_t)n))
+                return; // busy
+            m_current->block = true;
+            m_block_sent += n;
+        }
+    }
+
+    void CModbusMaster::abort_block(void)
+    {
+        m_block_buffer = NULL;
+
+        // forget about any other parts still in the pipeline
+        for (size_t i = 0; m_tcp && i < m_depth; ++i)
+        {
+            if (m_transactions[i].block)
+                m_transactions[i].pending = false;
+        }
+    }
+
     bool CModbusMaster::write_registers_req(const enum function_code::function_code func, const uint8_t slave, const uint16_t address, const uint16_t* begin, const uint16_t* end)
     {
         const size_t n = end - begin;
@@ -208,13 +493,9 @@ namespace ModbusPotato
             *buffer++ = (uint8_t) n;
             *buffer++ = (uint8_t) 2*n;
         }
-        for (const uint16_t* i = begin; i != end; ++i)
-        {
-            *buffer++ = (uint8_t) (*i >> 8);
-            *buffer++ = (uint8_t) *i;
-        }
+        convert_registers(buffer, begin, n);
 
-        m_write_starting_address = address;
+        m_current->write_starting_address = address;
         send_and_wait(slave, len);
         return true;
     }
@@ -266,15 +547,11 @@ namespace ModbusPotato
         *buffer++ = (uint8_t) (write_n >> 8);
         *buffer++ = (uint8_t) (write_n >> 0);
         *buffer++ = (uint8_t) 2*write_n;
-        for (const uint16_t* i = write_begin; i != write_end; ++i)
-        {
-                *buffer++ = (uint8_t) (*i >> 8);
-                *buffer++ = (uint8_t) *i;
-        }
+        convert_registers(buffer, write_begin, write_n);
 
-        m_read_starting_address  = read_address;
-        m_write_starting_address = write_address;
-        m_write_n                = write_n;
+        m_current->read_starting_address  = read_address;
+        m_current->write_starting_address = write_address;
+        m_current->write_n                = write_n;
         send_and_wait(slave, len);
         return true;
     }
@@ -287,6 +564,20 @@ namespace ModbusPotato
             return false;
         if (m_framer->buffer_max() < len)
             return false;
+
+        // find a free transaction slot
+        if (m_tcp)
+        {
+            m_current = NULL;
+            for (size_t i = 0; i < m_depth && !m_current; ++i)
+            {
+                if (!m_transactions[i].pending)
+                    m_current = &m_transactions[i];
+            }
+            if (!m_current)
+                return false; // pipeline full
+        }
+
         if (!m_framer->begin_send())
             return false;
 
@@ -300,10 +591,58 @@ namespace ModbusPotato
         m_framer->send();
 
         // update state
-        m_timer = m_time_provider->ticks();
-        m_slave_address = slave;
+        m_current->timer = m_time_provider->ticks();
+        m_current->slave = slave;
+        m_current->function = m_framer->buffer()[0];
+        m_current->block = false;
+        if (m_tcp)
+        {
+            // the master stays idle so that more requests can be queued
+            m_current->id = m_tcp->transaction_id();
+            m_current->pending = true;
+            return;
+        }
         m_state = (slave == 0)
                 ? state::waiting_turnaround_reply
                 : state::waiting_for_reply;
     }
+
+    CModbusMaster::transaction* CModbusMaster::find_transaction(IFramer* framer)
+    {
+        if (!m_tcp)
+        {
+            if (m_state != state::waiting_for_reply)
+                return NULL;
+
+            // unexpected slave
+            if (framer->frame_address() != m_transaction.slave)
+            {
+                m_transaction.timer = m_time_provider->ticks();
+                return NULL;
+            }
+
+            return m_current = &m_transaction;
+        }
+
+        if (m_state != state::idle)
+            return NULL;
+
+        // match the response to its request by the transaction id
+        for (size_t i = 0; i < m_depth; ++i)
+        {
+            transaction* t = &m_transactions[i];
+            if (!t->pending || t->id != m_tcp->transaction_id())
+                continue;
+
+            // unexpected slave; keep waiting for the real response
+            if (framer->frame_address() != t->slave)
+                return NULL;
+
+            // the slot can be re-used as soon as the response has been handled
+            t->pending = false;
+            return m_current = t;
+        }
+
+        return NULL; // late or unknown response
+    }
 }
@@ -1,18 +1,86 @@
+#ifndef __ModbusPotato_ModbusMaster_h__
+#define __ModbusPotato_ModbusMaster_h__
 #include <initializer_list>
 #include <iterator>
 #include "ModbusInterface.h"
 namespace ModbusPotato
 {
+    // forward declarations
+    class CModbusTCP;
+
     /// <summary>
     /// This class implements a basic Modbus master interface.
     /// </summary>
+    /// <remarks>
+    /// On a serial line only one request can be outstanding at a time, and
+    /// any new request is rejected until the response has been handled or
+    /// the response time out has elapsed.
+    ///
+    /// Over Modbus TCP, the master can instead be constructed in pipelined
+    /// mode with an array of transaction slots.  Up to that many requests
+    /// may then be outstanding at the same time; each response is matched to
+    /// its request by the MBAP transaction id, and each request has its own
+    /// response time out.  A request is only rejected when all the slots are
+    /// in use, or when the framer is busy sending the previous request or
+    /// receiving a response, in which case it can be retried after the
+    /// framer has been polled.
+    /// </remarks>
     class CModbusMaster : public IFrameHandler
     {
     public:
+        /// <summary>
+        /// Context of a request that is waiting for its response.
+        /// </summary>
+        struct transaction
+        {
+            bool pending;                       // waiting for the response (pipelined mode only)
+            uint16_t id;                        // MBAP transaction id (pipelined mode only)
+            bool block;                         // part of a block read
+            uint8_t slave;
+            uint8_t function;                   // function code of the request
+            uint16_t read_starting_address;
+            uint16_t read_n;
+            uint16_t write_starting_address;
+            uint16_t write_n;
+            system_tick_t timer;                // time the request was sent
+        };
+
         CModbusMaster(IMasterHandler* handler, IFramer* framer, ITimeProvider* timer, unsigned int response_time_out = 200, unsigned int turnaround_delay = 1000);
 
-        bool read_coils_req(void);
-        bool read_discrete_inputs_req(void);
+        /// <summary>
+        /// Constructor for the pipelined mode over Modbus TCP.
+        /// </summary>
+        /// <remarks>
+        /// Up to depth requests may be outstanding at the same time, each
+        /// using one of the given transactions.  Since the unit id is not
+        /// used for broadcasts on TCP, a response is expected for every
+        /// request, including those sent to slave 0.
+        /// </remarks>
+        CModbusMaster(IMasterHandler* handler, CModbusTCP* framer, ITimeProvider* timer, transaction* transactions, size_t depth, unsigned int response_time_out = 200);
+
+        /// <summary>
+        /// Returns the number of requests that are waiting for a response.
+        /// </summary>
+        size_t pending() const;
+
+        /// <summary>
+        /// Returns the transaction of the response being handled.
+        /// </summary>
+        /// <remarks>
+        /// This is valid from within the IMasterHandler callbacks, to tell
+        /// apart responses from different slaves or requests.  After a
+        /// successful request, it returns the transaction of that request.
+        /// </remarks>
+        const transaction* current() const { return m_current; }
+
+        inline bool read_coils_req(const uint8_t slave, const uint16_t address, const uint16_t n)
+        {
+            return read_bits_req(function_code::read_coil_status, slave, address, n);
+        }
+        inline bool read_discrete_inputs_req(const uint8_t slave, const uint16_t address, const uint16_t n)
+        {
+            return read_bits_req(function_code::read_discrete_input_status, slave, address, n);
+        }
         inline bool read_holding_registers_req(const uint8_t slave, const uint16_t address, const uint16_t n)
         {
             return read_registers_req(function_code::read_holding_registers, slave, address, n);
@@ -22,13 +90,60 @@ namespace ModbusPotato
             return read_registers_req(function_code::read_input_registers, slave, address, n);
         }
 
-        bool write_single_coil_req(void);
+        /// <summary>
+        /// Reads a range of holding registers of any size.
+        /// </summary>
+        /// <returns>
+        /// true if the first request was sent, or queued when called from a
+        /// response callback, or false if the master is busy or the range is
+        /// invalid.
+        /// </returns>
+        /// <remarks>
+        /// The range is read with as many requests of up to 125 registers as
+        /// needed, each one sent as soon as the master is able to, and the
+        /// values are stored directly in the given buffer, which must hold n
+        /// registers and stay valid until the read is done.  When all the
+        /// registers have been read, read_holding_registers_block_rsp() is
+        /// called once.
+        ///
+        /// If any of the requests fails, the block read is aborted after the
+        /// usual time out, exception or error callback for that request.
+        /// Only one block read can be in progress at a time, but the next one
+        /// may be started from the read_*_registers_block_rsp() callback of
+        /// the previous one; its first request is then sent as soon as that
+        /// response has been handled.
+        /// </remarks>
+        inline bool read_holding_registers_block_req(const uint8_t slave, const uint16_t address, const size_t n, uint16_t* buffer)
+        {
+            return read_registers_block_req(function_code::read_holding_registers, slave, address, n, buffer);
+        }
+        inline bool read_input_registers_block_req(const uint8_t slave, const uint16_t address, const size_t n, uint16_t* buffer)
+        {
+            return read_registers_block_req(function_code::read_input_registers, slave, address, n, buffer);
+        }
+
+        /// <summary>
+        /// Indicates if a block read is in progress.
+        /// </summary>
+        bool block_busy() const { return m_block_buffer != NULL; }
+
+        bool write_single_coil_req(const uint8_t slave, const uint16_t address, const bool value);
         inline bool write_single_register_req(const uint8_t slave, const uint16_t address, const uint16_t value)
         {
             const std::initializer_list<uint16_t> data = {value};
             return write_registers_req(function_code::write_single_register, slave, address, data.begin(), data.end());
         }
-        bool write_multiple_coils_req(void);
+
+        /// <summary>
+        /// Writes up to 1968 coils.
+        /// </summary>
+        /// <remarks>
+        /// The packed version takes the coils 8 to a byte, with the first
+        /// coil in the least significant bit of the first byte, and copies
+        /// them into the request as they are.
+        /// </remarks>
+        bool write_multiple_coils_req(const uint8_t slave, const uint16_t address, const size_t n, const uint8_t* bits);
+        bool write_multiple_coils_req(const uint8_t slave, const uint16_t address, const size_t n, const bool values[]);
         inline bool write_multiple_registers_req(const uint8_t slave, const uint16_t address, const std::initializer_list<uint16_t> data)
         {
             return write_multiple_registers_req(slave, address, data.begin(), data.end());
@@ -86,15 +201,34 @@ namespace ModbusPotato
         system_tick_t m_turnaround_delay;
 
         enum state m_state;
-        system_tick_t m_timer;
-        uint16_t m_slave_address;
-        uint16_t m_read_starting_address;
-        uint16_t m_write_starting_address;
-        uint16_t m_write_n;
+        CModbusTCP* m_tcp;                      // set in pipelined mode
+        transaction* m_transactions;
+        size_t m_depth;
+        transaction m_transaction;              // the only transaction in serial mode
+        transaction* m_current;                 // transaction of the request or response being processed
+
+        uint16_t* m_block_buffer;               // destination of the block read in progress, or NULL
+        enum function_code::function_code m_block_function;
+        uint8_t m_block_slave;
+        uint16_t m_block_address;
+        size_t m_block_n;
+        size_t m_block_sent;                    // number of registers requested so far
+        size_t m_block_left;                    // number of registers not received yet
+
+        bool read_bits_req(const enum function_code::function_code func, const uint8_t slave, const uint16_t address, const uint16_t n);
+        bool read_bits_rsp(IFramer* framer, const enum function_code::function_code func);
+
+        uint8_t* write_coils_req(const uint8_t slave, const uint16_t address, const size_t n);
+        bool write_coils_rsp(IFramer* framer, bool single);
 
         bool read_registers_req(const enum function_code::function_code func, const uint8_t slave, const uint16_t address, const uint16_t n);
         bool read_registers_rsp(IFramer* framer, const enum function_code::function_code func);
 
+        bool read_registers_block_req(const enum function_code::function_code func, const uint8_t slave, const uint16_t address, const size_t n, uint16_t* buffer);
+        bool read_registers_block_rsp(const uint8_t* buffer, size_t count);
+        void send_block(void);
+        void abort_block(void);
+
         bool write_registers_req(const enum function_code::function_code func, const uint8_t slave, const uint16_t address, const uint16_t* begin, const uint16_t* end);
         bool write_registers_rsp(IFramer* framer, bool single);
 
@@ -102,5 +236,7 @@ namespace ModbusPotato
 
         bool sanity_check(const size_t n, const size_t n_max, const size_t len);
         void send_and_wait(uint8_t slave, size_t len);
+        transaction* find_transaction(IFramer* framer);
 };
 }
+#endif
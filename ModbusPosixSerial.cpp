@@ -0,0 +1,322 @@
+#include "ModbusPosixSerial.h"
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <linux/serial.h>
+namespace ModbusPotato
+{
+    // convert the baud rate to the termios speed constant, or 0 if not supported
+    static speed_t baud_to_speed(unsigned long baud)
+    {
+        static const struct { unsigned long baud; speed_t speed; } speeds[] =
+        {
+            { 1200, B1200 },
+            { 2400, B2400 },
+            { 4800, B4800 },
+            { 9600, B9600 },
+            { 19200, B19200 },
+            { 38400, B38400 },
+            { 57600, B57600 },
+            { 115200, B115200 },
+            { 230400, B230400 },
+            { 460800, B460800 },
+            { 500000, B500000 },
+            { 576000, B576000 },
+            { 921600, B921600 },
+            { 1000000, B1000000 },
+            { 1152000, B1152000 },
+            { 1500000, B1500000 },
+            { 2000000, B2000000 },
+            { 2500000, B2500000 },
+            { 3000000, B3000000 },
+            { 3500000, B3500000 },
+            { 4000000, B4000000 },
+        };
+        for (size_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); ++i)
+        {
+            if (speeds[i].baud == baud)
+                return speeds[i].speed;
+        }
+        return 0;
+    }
+
+    CModbusPosixSerial::CModbusPosixSerial()
+        :   m_fd(-1)
+        ,   m_rs485()
+        ,   m_escape()
+        ,   m_lsr_supported(true)
+    {
+    }
+
+    CModbusPosixSerial::~CModbusPosixSerial()
+    {
+        close();
+    }
+
+    bool CModbusPosixSerial::open(const char* device, unsigned long baud, parity_type parity, unsigned int stop_bits)
+    {
+        close();
+
+        speed_t speed = baud_to_speed(baud);
+        if (!speed || stop_bits < 1 || stop_bits > 2)
+        {
+            errno = EINVAL;
+            return false;
+        }
+
+        int fd = ::open(device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        struct termios tio;
+        if (tcgetattr(fd, &tio) != 0)
+        {
+            int ec = errno;
+            ::close(fd);
+            errno = ec;
+            return false;
+        }
+
+        // raw 8 bit characters, no flow control
+        cfmakeraw(&tio);
+        tio.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS);
+        tio.c_cflag |= CS8 | CLOCAL | CREAD;
+        switch (parity)
+        {
+        case parity_none:
+            break;
+        case parity_even:
+            tio.c_cflag |= PARENB;
+            break;
+        case parity_odd:
+            tio.c_cflag |= PARENB | PARODD;
+            break;
+        }
+        if (stop_bits == 2)
+            tio.c_cflag |= CSTOPB;
+
+        // mark parity, framing and break errors in-band as \377 \0 <char>
+        //
+        // Note: a received \377 is doubled up in this mode, so read() must
+        // decode it.
+        //
+        tio.c_iflag = INPCK | PARMRK;
+
+        // return immediately from read() with whatever is available
+        tio.c_cc[VMIN] = 0;
+        tio.c_cc[VTIME] = 0;
+
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+        if (tcsetattr(fd, TCSANOW, &tio) != 0)
+        {
+            int ec = errno;
+            ::close(fd);
+            errno = ec;
+            return false;
+        }
+
+        // discard anything received before the port was configured
+        tcflush(fd, TCIOFLUSH);
+
+        m_fd = fd;
+        m_rs485 = false;
+        m_escape = false;
+        m_lsr_supported = true;
+        return true;
+    }
+
+    void CModbusPosixSerial::close()
+    {
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    bool CModbusPosixSerial::set_rs485(bool enable, unsigned int delay_before_send, unsigned int delay_after_send, bool rts_active_low)
+    {
+        if (m_fd < 0)
+        {
+            errno = EBADF;
+            return false;
+        }
+
+        struct serial_rs485 rs485;
+        memset(&rs485, 0, sizeof(rs485));
+        if (enable)
+        {
+            // drive RTS while sending and release it afterwards; the
+            // receiver is left disabled while sending so there is no echo
+            rs485.flags = SER_RS485_ENABLED;
+            rs485.flags |= rts_active_low ? SER_RS485_RTS_AFTER_SEND : SER_RS485_RTS_ON_SEND;
+            rs485.delay_rts_before_send = delay_before_send;
+            rs485.delay_rts_after_send = delay_after_send;
+        }
+
+        if (ioctl(m_fd, TIOCSRS485, &rs485) != 0)
+        {
+            m_rs485 = false;
+            return false;
+        }
+
+        m_rs485 = enable;
+        return true;
+    }
+
+    int CModbusPosixSerial::read(uint8_t* buffer, size_t buffer_size)
+    {
+        if (m_fd < 0 || !buffer_size)
+            return 0;
+
+        // if there is no buffer provided, then dump the input
+        if (!buffer)
+            return dump(buffer_size);
+
+        if (buffer_size > INT_MAX)
+            buffer_size = INT_MAX;
+
+        // read everything available in a single call
+        ssize_t len = ::read(m_fd, buffer, buffer_size);
+        if (len < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+
+        // fast path: nothing to decode
+        if (!m_escape && !memchr(buffer, 0xff, len))
+            return (int)len;
+
+        // decode the PARMRK sequences in place
+        //
+        // \377 \377 is a received \377, and \377 \0 <char> is a parity or
+        // framing error (or a break if <char> is \0).  The sequence may be
+        // split across two reads, so the leading \377 is remembered.
+        //
+        size_t out = 0;
+        for (ssize_t i = 0; i < len; ++i)
+        {
+            uint8_t ch = buffer[i];
+            if (!m_escape)
+            {
+                if (ch == 0xff)
+                    m_escape = true;
+                else
+                    buffer[out++] = ch;
+                continue;
+            }
+
+            m_escape = false;
+            if (ch != 0xff)
+            {
+                // communications error; dump the rest of the input
+                dump((size_t)-1);
+                return -1;
+            }
+            buffer[out++] = ch;
+        }
+
+        return (int)out;
+    }
+
+    int CModbusPosixSerial::write(uint8_t* buffer, size_t len)
+    {
+        if (m_fd < 0 || !len)
+            return 0;
+
+        if (len > INT_MAX)
+            len = INT_MAX;
+
+        // write as much as the driver will accept in a single call
+        ssize_t ec = ::write(m_fd, buffer, len);
+        if (ec < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        return (int)ec;
+    }
+
+    int CModbusPosixSerial::writev(const segment* segments, size_t count)
+    {
+        if (m_fd < 0)
+            return 0;
+
+        // gather the buffers so that the whole frame is queued by a single system call
+        iovec iov[max_segments];
+        size_t n = 0, len = 0;
+        for (size_t i = 0; i < count && n < max_segments; ++i)
+        {
+            if (!segments[i].len)
+                continue;
+            if (segments[i].len > INT_MAX - len)
+                break;
+            iov[n].iov_base = segments[i].buffer;
+            iov[n].iov_len = segments[i].len;
+            len += segments[i].len;
+            ++n;
+        }
+        if (!n)
+            return 0;
+
+        ssize_t ec = ::writev(m_fd, iov, (int)n);
+        if (ec < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        return (int)ec;
+    }
+
+    void CModbusPosixSerial::txEnable(bool)
+    {
+        // nothing to do; the driver switches the direction in RS-485 mode (see set_rs485())
+    }
+
+    bool CModbusPosixSerial::writeComplete()
+    {
+        if (m_fd < 0)
+            return true;
+
+        // check if the driver still has characters queued
+        int pending = 0;
+        if (ioctl(m_fd, TIOCOUTQ, &pending) == 0 && pending > 0)
+            return false;
+
+        // the driver queue is empty; check if the UART has finished shifting out the last character
+        if (m_lsr_supported)
+        {
+            unsigned int lsr = 0;
+            if (ioctl(m_fd, TIOCSERGETLSR, &lsr) == 0)
+                return (lsr & TIOCSER_TEMT) != 0;
+
+            // not supported by this driver (i.e. most USB adapters)
+            m_lsr_supported = false;
+        }
+
+        // fall back to waiting for the few characters left in the hardware FIFO
+        tcdrain(m_fd);
+        return true;
+    }
+
+    int CModbusPosixSerial::dump(size_t buffer_size)
+    {
+        // the remainder of any PARMRK sequence is discarded along with everything else
+        m_escape = false;
+
+        uint8_t scratch[256];
+        int total = 0;
+        while (buffer_size)
+        {
+            size_t len = buffer_size < sizeof(scratch) ? buffer_size : sizeof(scratch);
+            ssize_t ec = ::read(m_fd, scratch, len);
+            if (ec <= 0)
+                break;
+            if (total < INT_MAX - (int)ec)
+                total += (int)ec;
+            if (buffer_size != (size_t)-1)
+                buffer_size -= ec;
+        }
+        return total;
+    }
+}
+#endif
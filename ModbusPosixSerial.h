@@ -0,0 +1,106 @@
+#ifndef __ModbusPosixSerial_h__
+#define __ModbusPosixSerial_h__
+#include "ModbusInterface.h"
+#ifdef __linux__
+namespace ModbusPotato
+{
+    /// <summary>
+    /// This class provides access to a Linux tty device using termios.
+    /// </summary>
+    /// <remarks>
+    /// The port is opened in non-blocking mode, so each call to read() or
+    /// write() is a single system call that transfers as much data as the
+    /// driver has ready.
+    ///
+    /// Parity, framing and break errors are detected using PARMRK, in which
+    /// case read() dumps the remaining input and returns -1 as required by
+    /// the IStream interface.
+    ///
+    /// The direction of an RS-485 transceiver is either switched by the
+    /// driver (see set_rs485()), or by the application.  In the latter
+    /// case, derive from this class and override txEnable() to drive the
+    /// transceiver, such as with a GPIO; the framer calls it with true
+    /// before the first character of a frame is written and with false
+    /// once writeComplete() returns true.
+    /// </remarks>
+    class CModbusPosixSerial : public IStream
+    {
+    public:
+        enum parity_type
+        {
+            parity_none,
+            parity_even,
+            parity_odd,
+        };
+
+        CModbusPosixSerial();
+        virtual ~CModbusPosixSerial();
+
+        /// <summary>
+        /// Opens and configures the given tty device (i.e. "/dev/ttyS0").
+        /// </summary>
+        /// <returns>
+        /// true if successful, or false if the device could not be opened or
+        /// the settings are not supported, in which case errno is set.
+        /// </returns>
+        /// <remarks>
+        /// The Modbus specification requires even parity by default, and two
+        /// stop bits when no parity is used.
+        /// </remarks>
+        bool open(const char* device, unsigned long baud, parity_type parity = parity_even, unsigned int stop_bits = 1);
+
+        /// <summary>
+        /// Closes the device, if open.
+        /// </summary>
+        void close();
+
+        /// <summary>
+        /// Enables or disables the kernel RS-485 direction control.
+        /// </summary>
+        /// <returns>
+        /// true if successful, or false if the driver does not support
+        /// RS-485 mode, in which case errno is set.
+        /// </returns>
+        /// <remarks>
+        /// When enabled, the UART driver asserts RTS while sending and
+        /// releases it from the transmit interrupt after the last
+        /// character, so the framer does not call txEnable(false) itself.
+        /// It still waits for the transmitter to drain and for the T3.5
+        /// delay before receiving again.  The delays are in
+        /// milliseconds.  Set rts_active_low if the transceiver driver
+        /// enable input is active low.
+        ///
+        /// This must be called after open().
+        /// </remarks>
+        bool set_rs485(bool enable, unsigned int delay_before_send = 0, unsigned int delay_after_send = 0, bool rts_active_low = false);
+
+        /// <summary>
+        /// Returns the file descriptor of the device, or -1 if not open.
+        /// </summary>
+        /// <remarks>
+        /// This can be used to wait for input using select(), poll() or
+        /// epoll() before calling the framer's poll() method.
+        /// </remarks>
+        int fd() const { return m_fd; }
+
+        virtual int read(uint8_t* buffer, size_t buffer_size);
+        virtual int write(uint8_t* buffer, size_t len);
+        virtual int writev(const segment* segments, size_t count);
+        virtual void txEnable(bool state);
+        virtual bool writeComplete();
+        virtual bool txAutoTurnaround() { return m_rs485; }
+        virtual void communicationStatus(bool, bool) {}
+    private:
+        enum
+        {
+            max_segments = 8, // maximum number of buffers passed to writev() at once
+        };
+        int dump(size_t buffer_size);
+        int m_fd;
+        bool m_rs485;
+        bool m_escape; // the last read ended with the first \377 of a PARMRK sequence
+        bool m_lsr_supported;
+    };
+}
+#endif
+#endif
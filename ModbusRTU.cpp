@@ -1,5 +1,6 @@
 #include "ModbusRTU.h"
 #include "ModbusUtil.h"
+#include "ModbusCRC16.h"
 #ifdef _MSC_VER
 #undef max
 #endif
@@ -29,25 +30,6 @@ namespace ModbusPotato
     static_assert(ELAPSED(~(system_tick_t)0, 0) == 1, "elapsed time roll-over check failed");
     #endif
 
-    static inline uint16_t crc16_modbus(uint16_t crc, const uint8_t* buffer, size_t len)
-    {
-        static constexpr uint16_t POLY = 0xa001;
-
-        for (; len; buffer++, len--)
-        {
-            crc ^= *buffer;
-            crc = (crc & 1) != 0 ? ((crc >> 1) ^ POLY) : (crc >> 1);
-            crc = (crc & 1) != 0 ? ((crc >> 1) ^ POLY) : (crc >> 1);
-            crc = (crc & 1) != 0 ? ((crc >> 1) ^ POLY) : (crc >> 1);
-            crc = (crc & 1) != 0 ? ((crc >> 1) ^ POLY) : (crc >> 1);
-            crc = (crc & 1) != 0 ? ((crc >> 1) ^ POLY) : (crc >> 1);
-            crc = (crc & 1) != 0 ? ((crc >> 1) ^ POLY) : (crc >> 1);
-            crc = (crc & 1) != 0 ? ((crc >> 1) ^ POLY) : (crc >> 1);
-            crc = (crc & 1) != 0 ? ((crc >> 1) ^ POLY) : (crc >> 1);
-        }
-        return crc;
-    }
-
     CModbusRTU::CModbusRTU(IStream* stream, ITimeProvider* timer, uint8_t* buffer, size_t buffer_max)
         :   IFramer(stream, timer, buffer, buffer_max)
         ,   m_checksum()
@@ -57,6 +39,7 @@ namespace ModbusPotato
         ,   m_T3p5()
         ,   m_T1p5()
         ,   m_crc16_calc(&crc16_modbus)
+        ,   m_strict()
     {
         if (!m_stream || !m_timer || !m_buffer || m_buffer_max < 3)
         {
@@ -130,16 +113,39 @@ namespace ModbusPotato
                 m_crc16_calc = crc16_calc;
     }
 
+    int CModbusRTU::tx_write()
+    {
+        // the frame is the station address, the PDU and the CRC, low byte first
+        uint8_t crc[CRC_LEN] = { (uint8_t)m_checksum, (uint8_t)(m_checksum >> 8) };
+        IStream::segment segments[] = { { &m_frame_address, 1 }, { m_buffer, m_buffer_len }, { crc, CRC_LEN } };
+        IStream::segment* end = segments + sizeof(segments) / sizeof(segments[0]);
+
+        // skip the part that has already been sent
+        IStream::segment* next = segments;
+        size_t pos = m_buffer_tx_pos;
+        while (next != end && pos >= next->len)
+            pos -= next++->len;
+        if (next == end)
+            return 0;
+        next->buffer += pos;
+        next->len -= pos;
+
+        int ec = m_stream->writev(next, end - next);
+        if (ec > 0)
+            m_buffer_tx_pos += (uint16_t)ec;
+        return ec;
+    }
+
     unsigned long CModbusRTU::poll()
     {
         // state machine for handling incoming data
         //
-        //                    -------------           -------------
-        //        +--Sent--->|   TX CRC    |    +--->|   TX Wait   |
-        //        |           -------------     |     -------------
-        //        |                 |           |           |
-        //  -------------         Sent      TX Empty      T3.5                  start
-        // |   TX PDU    |          |           |           |                     |
+        //                                            -------------
+        //                                      +--->|   TX Wait   |
+        //                                      |     -------------
+        //                                      |           |
+        //  -------------                   TX Empty      T3.5                  start
+        // |   TX ADU    |---Sent---+           |           |                     |
         //  -------------           v           |           |                     v
         //        ^           -------------     |           v               -------------
         //        |          |  TX Drain   |----+    +------+<----T3.5-----|    Dump     |
@@ -170,8 +176,8 @@ namespace ModbusPotato
         //
         // This state machine is based on Figure 14 of the above PDF with the
         // "Control and Waiting" state split into "Dump", "Frame Ready" and
-        // "Queue", and the "Emission" state split into "TX Addr", "TX PDU" and
-        // "TX CRC" and "TX Done".
+        // "Queue", and the "Emission" state split into "TX Addr", "TX ADU",
+        // "TX Drain" and "TX Wait".
         //
         // Reason for goto statements: re-evaluate switch case labels when
         // changing states.
@@ -286,7 +292,7 @@ receive:
                     //
                     if (ec < 0
                     ||  (elapsed >= ((2*ec + 1)*m_T1p5/3 + quantization_rounding_count) &&
-                         pdu_short_()) )
+                         !frame_complete_()) )
                     {
                         // if so, reset the timer and enter the 'dump' state.
                         m_last_ticks = m_timer->ticks();
@@ -308,8 +314,8 @@ receive:
                     goto dump; // enter the dump state
                 }
 
-                // check if the T3.5 timer has elapsed
-                if (pdu_short_() && elapsed < m_T3p5)
+                // check if the T3.5 timer has elapsed, unless the frame is already complete
+                if (elapsed < m_T3p5 && !frame_complete_())
                     return m_T3p5 - elapsed; // wait for the timer to elapse
 
                 // check the CRC
@@ -346,7 +352,7 @@ receive:
                 return poll(); // jump to the start of the function to re-evalutate entire switch statement
             }
             break;
-        case state_tx_addr: // transmitting remote station address [RTU]
+        case state_tx_addr: // waiting to start transmitting the frame [RTU]
             {
                 // dump any incoming data
                 //
@@ -364,90 +370,31 @@ receive:
                     goto dump; // dump any remaining data
                 }
 
-                // try and write the remote station address
-                if (int ec = m_stream->write(&m_frame_address, 1))
-                {
-                    // check if something bad happened
-                    if (ec < 0)
-                    {
-                        m_state = state_exception;
-                        m_stream->communicationStatus(false, false);
-                        return 0; // fatal exception
-                    }
-
-                    // address sent; update the CRC while we send the frame address and move to the 'TX PDU' state
-                    m_checksum = m_crc16_calc(0xffff, &m_frame_address, 1);
-                    m_state = state_tx_pdu;
-                    m_buffer_tx_pos = 0;
-                    goto tx_pdu;
-                }
-
-                return 0; // waiting for room in the write buffer
+                // start sending the frame
+                goto tx_adu;
             }
-        case state_tx_pdu: // transmitting frame PDU
-tx_pdu:
+        case state_tx_adu: // transmitting the rest of the frame
+tx_adu:
             {
-                // send the next chunk
-                if (int ec = m_stream->write(m_buffer + m_buffer_tx_pos, m_buffer_len - m_buffer_tx_pos))
-                {
-                    // check if something bad happened
-                    if (ec < 0)
-                    {
-                        m_state = state_exception;
-                        m_stream->communicationStatus(false, false);
-                        return 0; // fatal exception
-                    }
-
-                    // update the CRC while we send the bytes and advance the buffer tx position
-                    m_checksum = m_crc16_calc(m_checksum, m_buffer + m_buffer_tx_pos, ec);
-                    m_buffer_tx_pos += ec;
-                }
-
-                // dump our own echo
-                m_stream->read(NULL, (size_t)-1);
-
-                // check if we should start sending the CRC
-                if (m_buffer_tx_pos == m_buffer_len)
+                // send as much of the frame as the stream will take in a single call
+                int ec = tx_write();
+                if (ec < 0)
                 {
-                    // if so, enter the 'TX CRC' state
-                    m_state = state_tx_crc;
-                    m_buffer_tx_pos = 0;
-                    goto tx_crc; // enter the 'TX CRC' state
+                    m_state = state_exception;
+                    m_stream->communicationStatus(false, false);
+                    return 0; // fatal exception
                 }
 
-                return 0; // waiting for room in the write buffer
-            }
-            break;
-        case state_tx_crc: // transmitting the frame CRC
-tx_crc:
-            {
-                // similiar to above, except we send the CRC instead of the data
-                while (m_buffer_tx_pos != CRC_LEN)
-                {
-                    // write the next byte in the CRC
-                    uint8_t ch = (uint8_t)m_checksum;
-                    int ec = m_stream->write(&ch, 1);
-                    if (!ec)
-                        break;
-
-                    // check if something bad happened
-                    if (ec < 0)
-                    {
-                        m_state = state_exception;
-                        m_stream->communicationStatus(false, false);
-                        return 0; // fatal exception
-                    }
-
-                    // advance the high byte of the CRC to the low byte and start again
-                    m_checksum >>= 8;
-                    m_buffer_tx_pos++;
-                }
+                // check if anything was sent yet
+                if (!ec && m_state == state_tx_addr)
+                    return 0; // waiting for room in the write buffer
+                m_state = state_tx_adu;
 
                 // dump our own echo
                 m_stream->read(NULL, (size_t)-1);
 
                 // check if we should enter the 'TX Drain' state
-                if (m_buffer_tx_pos == CRC_LEN)
+                if (m_buffer_tx_pos == 1 + m_buffer_len + CRC_LEN)
                 {
                     m_state = state_tx_drain;
                     goto tx_drain; // enter the 'TX Drain' state
@@ -455,7 +402,6 @@ tx_crc:
 
                 return 0; // waiting for room in the write buffer
             }
-            break;
         case state_tx_drain: // waiting for the characters to finish transmitting
 tx_drain:
             {
@@ -465,8 +411,15 @@ tx_drain:
                 // poll if the write has completed
                 if (m_stream->writeComplete())
                 {
-                    // transmission complete; disable the RS-485 transmitter
-                    m_stream->txEnable(false);
+                    // transmission complete; disable the RS-485 transmitter, unless the driver already did
+                    //
+                    // Note: the T3.5 delay below is still needed in that
+                    // case, since it is measured from the last character
+                    // on the wire and keeps the next frame from following
+                    // this one without a gap.
+                    //
+                    if (!m_stream->txAutoTurnaround())
+                        m_stream->txEnable(false);
 
                     // go to the tx wait state so we can wait for the T3.5 delay
                     m_last_ticks = m_timer->ticks();
@@ -475,7 +428,12 @@ tx_drain:
                     goto tx_wait;
                 }
 
-                return 0; // waiting for write buffer to drain
+                // waiting for write buffer to drain
+                //
+                // Note: most platforms have no event for the end of the
+                // transmission, so check again after about a character.
+                //
+                return m_T1p5;
             }
             break;
         case state_tx_wait: // waiting for final T3.5 delay after transmitting
@@ -534,6 +492,11 @@ tx_wait:
         {
         case state_queue: // buffer is ready
             {
+                // calculate the CRC up front so that the whole frame can be written at once
+                m_checksum = m_crc16_calc(0xffff, &m_frame_address, 1);
+                m_checksum = m_crc16_calc(m_checksum, m_buffer, m_buffer_len);
+                m_buffer_tx_pos = 0;
+
                 // enter the transmit station address state
                 m_state = state_tx_addr;
                 m_stream->communicationStatus(false, true);
@@ -591,4 +554,10 @@ tx_wait:
     {
             return pdu_short(m_station_address, m_buffer, m_buffer_len);
     }
+
+    bool CModbusRTU::frame_complete_ () const
+    {
+        // the whole PDU has been received according to its function code, and the CRC matches
+        return !m_strict && m_checksum == 0 && !pdu_short_();
+    }
 }
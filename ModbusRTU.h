@@ -39,9 +39,34 @@ namespace ModbusPotato
         /// (inter-character) delay is calculated according to the baud rate
         /// parameter. On the other hand, the delay is manually set to value
         /// in microseconds.
+        ///
+        /// When crc16_calc is nullptr, the CRC16 implementation selected by
+        /// MODBUS_CRC16_DEFAULT is used.  Any of the crc16_modbus_xxx
+        /// functions in ModbusCRC16.h may be passed to override it at run
+        /// time.
         /// </remarks>
         void setup(unsigned long baud, unsigned int inter_frame_delay = 0 /* us */, unsigned int inter_char_delay = 0 /* us */, Crc16CalcFunc crc16_calc = nullptr);
 
+        /// <summary>
+        /// Selects strict T3.5 framing.
+        /// </summary>
+        /// <remarks>
+        /// By default, a frame whose length is known from its function code
+        /// is handed to the frame handler as soon as all of it has been
+        /// received and the CRC matches, rather than after the T3.5 silence
+        /// that ends it, which saves T3.5 on every request and response.  A
+        /// frame that is longer than its function code suggests still ends
+        /// at the T3.5 delay, as its CRC only matches once all of it has
+        /// been received.
+        ///
+        /// With strict framing, every frame ends at the T3.5 delay and any
+        /// gap of more than T1.5 within a frame drops it.  This may be
+        /// needed on noisy buses, where the CRC of a corrupted frame can
+        /// match by chance before the end of the frame.
+        /// </remarks>
+        void set_strict_framing(bool strict) { m_strict = strict; }
+        bool strict_framing() const { return m_strict; }
+
         unsigned long poll();
         bool begin_send();
         void send();
@@ -58,7 +83,7 @@ namespace ModbusPotato
             min_pdu_length = 3, // minimum PDU length, excluding the station address. function code and two crc bytes
         };
         uint16_t m_checksum;
-        uint8_t m_buffer_tx_pos;
+        uint16_t m_buffer_tx_pos;
         enum state_type
         {
             state_exception,
@@ -69,8 +94,7 @@ namespace ModbusPotato
             state_collision,
             state_receive,
             state_tx_addr,
-            state_tx_pdu,
-            state_tx_crc,
+            state_tx_adu,
             state_tx_drain,
             state_tx_wait,
         };
@@ -78,7 +102,10 @@ namespace ModbusPotato
         system_tick_t m_last_ticks;
         system_tick_t m_T3p5, m_T3p5_tx, m_T1p5;
         Crc16CalcFunc m_crc16_calc;
+        bool m_strict;
         size_t pdu_short_ () const;
+        bool frame_complete_ () const;
+        int tx_write();
     };
 }
 #endif
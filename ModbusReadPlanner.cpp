@@ -0,0 +1,243 @@
+#include "ModbusReadPlanner.h"
+namespace ModbusPotato
+{
+    // sort key of a point: slave, function and address
+    static uint32_t point_key(const CModbusReadPlanner::point& p)
+    {
+        return ((uint32_t)p.slave << 24)
+             | ((uint32_t)p.function << 16)
+             | p.address;
+    }
+
+    CModbusReadPlanner::CModbusReadPlanner(IMasterHandler* handler)
+        :   m_handler(handler)
+        ,   m_master()
+        ,   m_points()
+        ,   m_blocks()
+        ,   m_blocks_len()
+    {
+    }
+
+    size_t CModbusReadPlanner::plan(point* points, size_t n, block* blocks, size_t blocks_max, uint16_t gap)
+    {
+        m_points = points;
+        m_blocks = blocks;
+        m_blocks_len = 0;
+
+        // sort the points; an insertion sort keeps the order of equal points
+        for (size_t i = 1; i < n; ++i)
+        {
+            point p = points[i];
+            size_t j = i;
+            for (; j > 0 && point_key(points[j - 1]) > point_key(p); --j)
+                points[j] = points[j - 1];
+            points[j] = p;
+        }
+
+        // merge the points into blocks
+        block* b = NULL;
+        for (size_t i = 0; i < n; ++i)
+        {
+            const point& p = points[i];
+            unsigned long end = (unsigned long)p.address + p.count;
+
+            if (b && b->slave == p.slave && b->function == p.function)
+            {
+                // the point must start within the gap and the block must not grow past the limit
+                unsigned long b_end = (unsigned long)b->address + b->count;
+                unsigned long new_end = end > b_end ? end : b_end;
+                if (p.address <= b_end + gap && new_end - b->address <= 0x7d)
+                {
+                    b->count = (uint16_t)(new_end - b->address);
+                    b->n++;
+                    continue;
+                }
+            }
+
+            // start a new block
+            if (m_blocks_len >= blocks_max)
+            {
+                m_blocks_len = 0;
+                return 0; // out of blocks
+            }
+            b = &blocks[m_blocks_len++];
+            b->slave = p.slave;
+            b->function = p.function;
+            b->address = p.address;
+            b->count = p.count;
+            b->first = i;
+            b->n = 1;
+        }
+
+        return m_blocks_len;
+    }
+
+    bool CModbusReadPlanner::read_req(const block* b)
+    {
+        if (!m_master)
+            return false;
+
+        switch (b->function)
+        {
+        case function_code::read_holding_registers:
+            return m_master->read_holding_registers_req(b->slave, b->address, b->count);
+        case function_code::read_input_registers:
+            return m_master->read_input_registers_req(b->slave, b->address, b->count);
+        default:
+            return false;
+        }
+    }
+
+    const CModbusReadPlanner::block* CModbusReadPlanner::find_block(uint8_t function, uint16_t address, size_t n) const
+    {
+        if (!m_master || !m_master->current())
+            return NULL;
+
+        // the master knows which slave the response came from
+        uint8_t slave = m_master->current()->slave;
+        for (size_t i = 0; i < m_blocks_len; ++i)
+        {
+            const block* b = &m_blocks[i];
+            if (b->slave == slave && b->function == function && b->address == address && b->count == n)
+                return b;
+        }
+        return NULL;
+    }
+
+    const CModbusReadPlanner::block* CModbusReadPlanner::current_block() const
+    {
+        if (!m_master || !m_master->current())
+            return NULL;
+
+        // the block of the request that failed, if it was a planned one
+        const CModbusMaster::transaction* t = m_master->current();
+        return find_block(t->function, t->read_starting_address, t->read_n);
+    }
+
+    bool CModbusReadPlanner::dispatch(const block* b, const uint16_t* values)
+    {
+        // hand each consumer its own part of the block
+        bool ret = true;
+        for (size_t i = b->first; i < b->first + b->n; ++i)
+        {
+            const point& p = m_points[i];
+            if (!p.handler)
+                continue;
+
+            const uint16_t* data = values + (p.address - b->address);
+            bool ok = (p.function == function_code::read_holding_registers)
+                    ? p.handler->read_holding_registers_rsp(p.address, p.count, data)
+                    : p.handler->read_input_registers_rsp(p.address, p.count, data);
+            if (!ok)
+                ret = false;
+        }
+        return ret;
+    }
+
+    bool CModbusReadPlanner::read_holding_registers_rsp(uint16_t address, size_t n, const uint16_t* values)
+    {
+        if (const block* b = find_block(function_code::read_holding_registers, address, n))
+            return dispatch(b, values);
+        return m_handler ? m_handler->read_holding_registers_rsp(address, n, values) : true;
+    }
+
+    bool CModbusReadPlanner::read_input_registers_rsp(uint16_t address, size_t n, const uint16_t* values)
+    {
+        if (const block* b = find_block(function_code::read_input_registers, address, n))
+            return dispatch(b, values);
+        return m_handler ? m_handler->read_input_registers_rsp(address, n, values) : true;
+    }
+
+    bool CModbusReadPlanner::read_holding_registers_block_rsp(uint16_t address, size_t n, const uint16_t* values)
+    {
+        return m_handler ? m_handler->read_holding_registers_block_rsp(address, n, values) : true;
+    }
+
+    bool CModbusReadPlanner::read_input_registers_block_rsp(uint16_t address, size_t n, const uint16_t* values)
+    {
+        return m_handler ? m_handler->read_input_registers_block_rsp(address, n, values) : true;
+    }
+
+    bool CModbusReadPlanner::read_coils_rsp(uint16_t address, size_t n, const uint8_t* bits)
+    {
+        return m_handler ? m_handler->read_coils_rsp(address, n, bits) : true;
+    }
+
+    bool CModbusReadPlanner::read_discrete_inputs_rsp(uint16_t address, size_t n, const uint8_t* bits)
+    {
+        return m_handler ? m_handler->read_discrete_inputs_rsp(address, n, bits) : true;
+    }
+
+    bool CModbusReadPlanner::write_single_coil_rsp(uint16_t address, bool value)
+    {
+        return m_handler ? m_handler->write_single_coil_rsp(address, value) : true;
+    }
+
+    bool CModbusReadPlanner::write_single_register_rsp(uint16_t address)
+    {
+        return m_handler ? m_handler->write_single_register_rsp(address) : true;
+    }
+
+    bool CModbusReadPlanner::write_multiple_coils_rsp(uint16_t address, size_t n)
+    {
+        return m_handler ? m_handler->write_multiple_coils_rsp(address, n) : true;
+    }
+
+    bool CModbusReadPlanner::write_multiple_registers_rsp(uint16_t address, size_t n)
+    {
+        return m_handler ? m_handler->write_multiple_registers_rsp(address, n) : true;
+    }
+
+    bool CModbusReadPlanner::read_write_multiple_registers_rsp(uint16_t read_address, size_t read_n, const uint16_t* read_values, uint16_t write_address, size_t write_n)
+    {
+        return m_handler ? m_handler->read_write_multiple_registers_rsp(read_address, read_n, read_values, write_address, write_n) : true;
+    }
+
+    bool CModbusReadPlanner::response_time_out(void)
+    {
+        const block* b = current_block();
+        if (!b)
+            return m_handler ? m_handler->response_time_out() : true;
+
+        // the read of each consumer of the block has failed
+        bool ret = true;
+        for (size_t i = b->first; i < b->first + b->n; ++i)
+        {
+            if (m_points[i].handler && !m_points[i].handler->response_time_out())
+                ret = false;
+        }
+        return ret;
+    }
+
+    bool CModbusReadPlanner::exception_response(enum modbus_exception_code::modbus_exception_code code)
+    {
+        const block* b = current_block();
+        if (!b)
+            return m_handler ? m_handler->exception_response(code) : true;
+
+        // the read of each consumer of the block has failed
+        bool ret = true;
+        for (size_t i = b->first; i < b->first + b->n; ++i)
+        {
+            if (m_points[i].handler && !m_points[i].handler->exception_response(code))
+                ret = false;
+        }
+        return ret;
+    }
+
+    bool CModbusReadPlanner::processing_error(void)
+    {
+        const block* b = current_block();
+        if (!b)
+            return m_handler ? m_handler->processing_error() : true;
+
+        // the read of each consumer of the block has failed
+        bool ret = true;
+        for (size_t i = b->first; i < b->first + b->n; ++i)
+        {
+            if (m_points[i].handler && !m_points[i].handler->processing_error())
+                ret = false;
+        }
+        return ret;
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef __ModbusPotato_ModbusReadPlanner_h__
+#define __ModbusPotato_ModbusReadPlanner_h__
+#include "ModbusMaster.h"
+namespace ModbusPotato
+{
+    /// <summary>
+    /// This class merges register reads from the same slave into as few
+    /// requests as possible, and splits the responses back up.
+    /// </summary>
+    /// <remarks>
+    /// Each point is a range of holding or input registers of a slave,
+    /// along with the master handler that consumes it.  plan() sorts the
+    /// points and merges those of the same slave and function whose ranges
+    /// overlap, touch or are at most gap registers apart into blocks of no
+    /// more than 125 registers, which is the most a single request can
+    /// read.  Any registers in the gaps are read and dropped.
+    ///
+    /// The planner must be the handler of the master.  When the response to
+    /// a block arrives, each point of the block gets its own part of the
+    /// registers through its handler.  The block can be read with
+    /// read_req(), or through any other means such as a CModbusScanList
+    /// entry with the same slave, function, address and count.  Likewise,
+    /// when the request for a block times out, gets an exception response
+    /// or fails to be processed, each point of the block is told through
+    /// its handler, so that it does not keep using stale values.  All other
+    /// responses and events are passed on to the handler given to the
+    /// constructor, if any.
+    /// </remarks>
+    class CModbusReadPlanner : public IMasterHandler
+    {
+    public:
+        /// <summary>
+        /// A range of registers read by a consumer.
+        /// </summary>
+        /// <remarks>
+        /// The function must be read_holding_registers or
+        /// read_input_registers.
+        /// </remarks>
+        struct point
+        {
+            uint8_t slave;
+            uint8_t function;
+            uint16_t address;
+            uint16_t count;
+            IMasterHandler* handler;
+        };
+
+        /// <summary>
+        /// A range of registers read with a single request.
+        /// </summary>
+        /// <remarks>
+        /// The points of the block are points[first] through
+        /// points[first + n - 1].
+        /// </remarks>
+        struct block
+        {
+            uint8_t slave;
+            uint8_t function;
+            uint16_t address;
+            uint16_t count;
+            size_t first;
+            size_t n;
+        };
+
+        CModbusReadPlanner(IMasterHandler* handler = NULL);
+
+        /// <summary>
+        /// Sets the master used to send the requests.
+        /// </summary>
+        /// <remarks>
+        /// The master tells the planner which slave a response came from.
+        /// </remarks>
+        void set_master(CModbusMaster* master) { m_master = master; }
+
+        /// <summary>
+        /// Merges the points into blocks.
+        /// </summary>
+        /// <returns>
+        /// The number of blocks, or 0 if blocks_max is too small.
+        /// </returns>
+        /// <remarks>
+        /// The points are sorted in place by slave, function and address,
+        /// and both arrays must stay valid while the planner is in use.  A
+        /// point of more than 125 registers gets a block of its own, which
+        /// the master will refuse to send.
+        /// </remarks>
+        size_t plan(point* points, size_t n, block* blocks, size_t blocks_max, uint16_t gap = 0);
+
+        /// <summary>
+        /// Sends the request for the given block.
+        /// </summary>
+        /// <returns>
+        /// true if the request was sent, or false if the master is busy.
+        /// </returns>
+        bool read_req(const block* b);
+
+        bool read_coils_rsp(uint16_t address, size_t n, const uint8_t* bits) override;
+        bool read_discrete_inputs_rsp(uint16_t address, size_t n, const uint8_t* bits) override;
+        bool read_holding_registers_rsp(uint16_t address, size_t n, const uint16_t* values) override;
+        bool read_input_registers_rsp(uint16_t address, size_t n, const uint16_t* values) override;
+        bool read_holding_registers_block_rsp(uint16_t address, size_t n, const uint16_t* values) override;
+        bool read_input_registers_block_rsp(uint16_t address, size_t n, const uint16_t* values) override;
+        bool write_single_coil_rsp(uint16_t address, bool value) override;
+        bool write_single_register_rsp(uint16_t address) override;
+        bool write_multiple_coils_rsp(uint16_t address, size_t n) override;
+        bool write_multiple_registers_rsp(uint16_t address, size_t n) override;
+        bool read_write_multiple_registers_rsp(uint16_t read_address, size_t read_n, const uint16_t* read_values, uint16_t write_address, size_t write_n) override;
+        bool response_time_out(void) override;
+        bool exception_response(enum modbus_exception_code::modbus_exception_code code) override;
+        bool processing_error(void) override;
+    private:
+        const block* find_block(uint8_t function, uint16_t address, size_t n) const;
+        const block* current_block() const;
+        bool dispatch(const block* b, const uint16_t* values);
+
+        IMasterHandler* m_handler;
+        CModbusMaster* m_master;
+        point* m_points;
+        block* m_blocks;
+        size_t m_blocks_len;
+    };
+}
+#endif
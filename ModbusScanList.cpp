@@ -0,0 +1,131 @@
+#include "ModbusScanList.h"
+namespace ModbusPotato
+{
+    CModbusScanList::CModbusScanList(CModbusMaster* master, ITimeProvider* timer, entry* entries, size_t n, IHandler* handler)
+        :   m_master(master)
+        ,   m_time_provider(timer)
+        ,   m_entries(entries)
+        ,   m_n(entries ? n : 0)
+        ,   m_handler(handler)
+        ,   m_current()
+    {
+        reset();
+    }
+
+    void CModbusScanList::reset()
+    {
+        system_tick_t now = m_time_provider->ticks();
+        for (size_t i = 0; i < m_n; ++i)
+        {
+            m_entries[i].timer = now;
+            m_entries[i].done = false;
+            m_entries[i].misses = 0;
+        }
+    }
+
+    void CModbusScanList::poll()
+    {
+        // check for time outs first, so that the master is idle if it can be
+        m_master->poll();
+
+        // send as many requests as the master will take
+        //
+        // Note: this is at most one request per call, both for a serial
+        // master, which has a single outstanding request, and for a
+        // pipelined one, whose framer rejects the next request until its
+        // poll() has written out the previous one.
+        //
+        for (;;)
+        {
+            entry* e = next();
+            if (!e || !send(e))
+                return;
+        }
+    }
+
+    CModbusScanList::entry* CModbusScanList::next()
+    {
+        system_tick_t now = m_time_provider->ticks();
+        unsigned long us_per_tick = m_time_provider->microseconds_per_tick();
+
+        entry* best = NULL;
+        system_tick_t best_left = 0;
+        for (size_t i = 0; i < m_n; ++i)
+        {
+            entry* e = &m_entries[i];
+            system_tick_t period = (system_tick_t)((unsigned long)e->period * 1000 / us_per_tick);
+            if (!period)
+                period = 1;
+
+            // start a new period once the current one is over
+            system_tick_t elapsed = now - e->timer;
+            if (elapsed >= period)
+            {
+                unsigned long periods = elapsed / period;
+                e->timer += (system_tick_t)(periods * period);
+                elapsed -= (system_tick_t)(periods * period);
+
+                // the deadline has passed if it was not sent in time
+                unsigned long missed = e->done ? periods - 1 : periods;
+                e->done = false;
+                if (missed)
+                {
+                    e->misses += missed;
+                    if (m_handler)
+                        m_handler->deadline_missed(e, missed);
+                }
+            }
+            if (e->done)
+                continue;
+
+            // earliest deadline first, then the highest priority
+            system_tick_t left = period - elapsed;
+            if (!best || left < best_left || (left == best_left && e->priority < best->priority))
+            {
+                best = e;
+                best_left = left;
+            }
+        }
+        return best;
+    }
+
+    bool CModbusScanList::send(entry* e)
+    {
+        // skip any entries that the master would never accept
+        bool bits = e->function == function_code::read_coil_status
+                 || e->function == function_code::read_discrete_input_status;
+        if (e->count < 1 || e->count > (bits ? 0x7d0 : 0x7d))
+        {
+            e->done = true;
+            return true;
+        }
+
+        bool ret;
+        switch (e->function)
+        {
+        case function_code::read_coil_status:
+            ret = m_master->read_coils_req(e->slave, e->address, e->count);
+            break;
+        case function_code::read_discrete_input_status:
+            ret = m_master->read_discrete_inputs_req(e->slave, e->address, e->count);
+            break;
+        case function_code::read_holding_registers:
+            ret = m_master->read_holding_registers_req(e->slave, e->address, e->count);
+            break;
+        case function_code::read_input_registers:
+            ret = m_master->read_input_registers_req(e->slave, e->address, e->count);
+            break;
+        default:
+            // not supported; never send it
+            e->done = true;
+            return true;
+        }
+
+        if (!ret)
+            return false; // the master is busy; try again later
+
+        e->done = true;
+        m_current = e;
+        return true;
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef __ModbusPotato_ModbusScanList_h__
+#define __ModbusPotato_ModbusScanList_h__
+#include "ModbusMaster.h"
+namespace ModbusPotato
+{
+    /// <summary>
+    /// This class periodically polls a table of register blocks using a
+    /// CModbusMaster instance.
+    /// </summary>
+    /// <remarks>
+    /// Each entry is read once per period.  Whenever the master is able to
+    /// accept a new request, the entry that is due with the earliest
+    /// deadline (the end of its current period) is sent next, with the
+    /// priority breaking any ties.  Since poll() tries to send the next
+    /// request as soon as the master has finished with the previous one,
+    /// the bus is kept busy for as long as any entry is due.
+    ///
+    /// With a pipelined master, each call of poll() sends at most one
+    /// request, since the framer has to be polled to write a request out
+    /// before it accepts the next one.  The transaction slots are therefore
+    /// filled over successive passes of the main loop.
+    ///
+    /// An entry that has not been sent by the end of its period has missed
+    /// its deadline.  The miss is counted in the entry and reported to the
+    /// scan handler, and the entry is then scheduled for its next period.
+    ///
+    /// The responses are handled by the IMasterHandler of the master as
+    /// usual; current() returns the entry that a response belongs to.
+    /// </remarks>
+    class CModbusScanList
+    {
+    public:
+        /// <summary>
+        /// An entry of the scan list.
+        /// </summary>
+        /// <remarks>
+        /// The function must be read_coil_status,
+        /// read_discrete_input_status, read_holding_registers or
+        /// read_input_registers.  The period is in milliseconds, and a lower
+        /// priority value is more important.  The remaining fields are used
+        /// by the scheduler.
+        /// </remarks>
+        struct entry
+        {
+            uint8_t slave;
+            uint8_t function;
+            uint16_t address;
+            uint16_t count;
+            unsigned int period;
+            uint8_t priority;
+
+            system_tick_t timer;                // start of the current period
+            bool done;                          // sent during the current period
+            unsigned long misses;               // number of missed deadlines
+        };
+
+        /// <summary>
+        /// Handles scan list events.
+        /// </summary>
+        class IHandler
+        {
+        public:
+            virtual ~IHandler() {}
+
+            /// <summary>
+            /// An entry was not sent before the end of its period.
+            /// </summary>
+            /**
+             * @param entry   scan list entry
+             * @param missed  number of periods missed since the last call
+             */
+            virtual void deadline_missed(const entry*, unsigned long) {}
+        };
+
+        CModbusScanList(CModbusMaster* master, ITimeProvider* timer, entry* entries, size_t n, IHandler* handler = NULL);
+
+        /// <summary>
+        /// Polls the master and sends the next request that is due.
+        /// </summary>
+        /// <remarks>
+        /// This must be called from the main loop along with the poll()
+        /// method of the framer.
+        /// </remarks>
+        void poll();
+
+        /// <summary>
+        /// Restarts the period of every entry so that they are all due now.
+        /// </summary>
+        void reset();
+
+        /// <summary>
+        /// Returns the entry that was sent last.
+        /// </summary>
+        /// <remarks>
+        /// In the IMasterHandler callbacks, this is the entry the response
+        /// belongs to, unless the master is pipelined, in which case the
+        /// master's current() transaction must be used to tell them apart.
+        /// </remarks>
+        const entry* current() const { return m_current; }
+    private:
+        CModbusScanList(const CModbusScanList&);
+        CModbusScanList& operator=(const CModbusScanList&);
+        entry* next();
+        bool send(entry* e);
+
+        CModbusMaster* m_master;
+        ITimeProvider* m_time_provider;
+        entry* m_entries;
+        size_t m_n;
+        IHandler* m_handler;
+        entry* m_current;
+    };
+}
+#endif
@@ -1,8 +1,55 @@
 #include "ModbusSlave.h"
+#include "ModbusUtil.h"
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#define FUNCTION_TABLE_ATTR PROGMEM
+#define FUNCTION_TABLE_READ(entry) pgm_read_byte(&(entry))
+#else
+#define FUNCTION_TABLE_ATTR
+#define FUNCTION_TABLE_READ(entry) (entry)
+#endif
 namespace ModbusPotato
 {
-    CModbusSlave::CModbusSlave(ISlaveHandler* handler)
+    // built-in functions, indexed by the entries of builtin_function_index
+    const CModbusSlave::function_type CModbusSlave::builtin_functions[] =
+    {
+        NULL,
+        &CModbusSlave::read_coils_rsp,
+        &CModbusSlave::read_discrete_inputs_rsp,
+        &CModbusSlave::read_holding_registers_rsp,
+        &CModbusSlave::read_input_registers_rsp,
+        &CModbusSlave::write_single_coil_rsp,
+        &CModbusSlave::write_single_register_rsp,
+        &CModbusSlave::write_multiple_coils_rsp,
+        &CModbusSlave::write_multiple_registers_rsp,
+        &CModbusSlave::mask_write_register_rsp,
+        &CModbusSlave::read_write_multiple_registers_rsp,
+    };
+
+    // index into builtin_functions for each function code, or 0 if not supported
+    static const uint8_t builtin_function_index[256] FUNCTION_TABLE_ATTR =
+    {
+        0, 1, 2, 3, 4, 5, 6, 0, 0, 0, 0, 0, 0, 0, 0, 7, // 0x00
+        8, 0, 0, 0, 0, 0, 9,10, 0, 0, 0, 0, 0, 0, 0, 0, // 0x10
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x20
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x30
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x40
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x50
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x60
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x70
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x80
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x90
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0xa0
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0xb0
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0xc0
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0xd0
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0xe0
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0xf0
+    };
+
+    CModbusSlave::CModbusSlave(ISlaveHandler* handler, IFunctionHandler* const* functions)
         :   m_handler(handler)
+        ,   m_functions(functions)
     {
     }
 
@@ -25,35 +72,16 @@ namespace ModbusPotato
         // See http://www.modbus.org/docs/Modbus_Application_Protocol_V1_1b3.pdf
         //
         uint8_t result = modbus_exception_code::illegal_function;
-        if (m_handler)
+        uint8_t function = framer->buffer()[0];
+        if (m_functions && m_functions[function])
+        {
+            // user supplied function
+            result = m_functions[function]->execute(framer, m_handler);
+        }
+        else if (m_handler)
         {
-            switch (framer->buffer()[0])
-            {
-            case function_code::read_coil_status:
-                result = read_bit_input_rsp(framer, false);
-                break;
-            case function_code::read_discrete_input_status:
-                result = read_bit_input_rsp(framer, true);
-                break;
-            case function_code::read_holding_registers:
-                result = read_registers_rsp(framer, true);
-                break;
-            case function_code::read_input_registers:
-                result = read_registers_rsp(framer, false);
-                break;
-            case function_code::write_single_coil:
-                result = write_single_coil_rsp(framer);
-                break;
-            case function_code::write_single_register:
-                result = write_single_register_rsp(framer);
-                break;
-            case function_code::write_multiple_coils:
-                result = write_multiple_coils_rsp(framer);
-                break;
-            case function_code::write_multiple_registers:
-                result = write_multiple_registers_rsp(framer);
-                break;
-            }
+            if (uint8_t index = FUNCTION_TABLE_READ(builtin_function_index[function]))
+                result = (this->*builtin_functions[index])(framer);
         }
 
         // exit if this is a broadcast packet (no response needed)
@@ -142,7 +170,7 @@ namespace ModbusPotato
             return modbus_exception_code::illegal_data_value; // count not valid
 
         // get the pointer into the buffer for the resulting data
-        uint16_t* regs = (uint16_t*)(buffer + 2);
+        uint16_t* regs = aligned_registers(buffer + 2);
 
         // execute the handler
         uint8_t result = modbus_exception_code::illegal_function;
@@ -155,14 +183,13 @@ namespace ModbusPotato
         if (result != modbus_exception_code::ok)
             return result; // error
 
+        // fixup the byte order of the resulting registers and move them into place
+        registers_to_pdu(regs, buffer + 2, count, !m_handler->big_endian_registers());
+
         // set the resulting byte count and buffer length
         buffer[1] = count * 2;
         framer->set_buffer_len(buffer_len);
 
-        // fixup the byte order of the resulting registers
-        for (uint16_t i = 0; i < count; ++i)
-            regs[i] = htons(regs[i]);
-
         return modbus_exception_code::ok;
     }
 
@@ -243,12 +270,8 @@ namespace ModbusPotato
         if (count * 2 != check || check + 6 != (uint8_t) framer->buffer_len())
             return modbus_exception_code::illegal_data_value;
 
-        // get the pointer into the buffer for the resulting data
-        uint16_t* regs = (uint16_t*)(buffer + 6);
-
-        // fixup the byte order of the registers
-        for (uint16_t i = 0; i < count; ++i)
-            regs[i] = htons(regs[i]);
+        // get the pointer to the registers and fixup their byte order
+        uint16_t* regs = registers_from_pdu(buffer + 6, count, !m_handler->big_endian_registers());
 
         // execute the handler
         if (uint8_t result = m_handler->write_multiple_registers(address, count, regs))
@@ -263,4 +286,70 @@ namespace ModbusPotato
 
         return modbus_exception_code::ok;
     }
+
+    uint8_t CModbusSlave::mask_write_register_rsp(IFramer* framer)
+    {
+        if (framer->buffer_len() != 7)
+            return modbus_exception_code::illegal_function;
+
+        // determine the address and masks
+        uint8_t* buffer = framer->buffer();
+        uint16_t address = ((uint16_t)buffer[1] << 8) | buffer[2];
+        uint16_t and_mask = ((uint16_t)buffer[3] << 8) | buffer[4];
+        uint16_t or_mask = ((uint16_t)buffer[5] << 8) | buffer[6];
+
+        // execute the handler; the response is an echo of the request
+        return m_handler->mask_write_register(address, and_mask, or_mask);
+    }
+
+    uint8_t CModbusSlave::read_write_multiple_registers_rsp(IFramer* framer)
+    {
+        // see Figure 27 of http://www.modbus.org/docs/Modbus_Application_Protocol_V1_1b3.pdf
+        if (framer->buffer_len() < 10)
+            return modbus_exception_code::illegal_function;
+
+        // determine the addresses and counts
+        uint8_t* buffer = framer->buffer();
+        uint16_t read_address = ((uint16_t)buffer[1] << 8) | buffer[2];
+        uint16_t read_count = ((uint16_t)buffer[3] << 8) | buffer[4];
+        uint16_t write_address = ((uint16_t)buffer[5] << 8) | buffer[6];
+        uint16_t write_count = ((uint16_t)buffer[7] << 8) | buffer[8];
+        uint8_t check = buffer[9];
+
+        // determine the resulting buffer length
+        //
+        // buffer[0] = fc
+        // buffer[1] = byte count
+        // buffer[2+] = data
+        //
+        size_t buffer_len = read_count * 2 + 2;
+
+        // make sure the counts are valid
+        if (read_count < 1 || read_count > 0x7d || write_count < 1 || write_count > 0x79
+        ||  write_count * 2 != check || check + 10 != (uint8_t) framer->buffer_len()
+        ||  buffer_len > framer->buffer_max())
+            return modbus_exception_code::illegal_data_value;
+
+        // get the pointers into the buffer for the written and resulting data
+        //
+        // Note: these overlap, which is fine as long as the handler is done
+        // with the written values before it stores the result.
+        //
+        bool convert = !m_handler->big_endian_registers();
+        uint16_t* write_regs = registers_from_pdu(buffer + 10, write_count, convert);
+        uint16_t* read_regs = aligned_registers(buffer + 2);
+
+        // execute the handler
+        if (uint8_t result = m_handler->read_write_multiple_registers(read_address, read_count, read_regs, write_address, write_count, write_regs))
+            return result; // error
+
+        // fixup the byte order of the resulting registers and move them into place
+        registers_to_pdu(read_regs, buffer + 2, read_count, convert);
+
+        // set the resulting byte count and buffer length
+        buffer[1] = read_count * 2;
+        framer->set_buffer_len(buffer_len);
+
+        return modbus_exception_code::ok;
+    }
 }
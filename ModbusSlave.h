@@ -1,21 +1,41 @@
+#ifndef __ModbusPotato_ModbusSlave_h__
+#define __ModbusPotato_ModbusSlave_h__
 #include "ModbusInterface.h"
 namespace ModbusPotato
 {
     /// <summary>
     /// This class implements a basic Modbus slave interface.
     /// </summary>
+    /// <remarks>
+    /// The function code of each request is looked up in a table of 256
+    /// entries, so an unsupported function costs a single lookup.  Other
+    /// function codes can be added, or the built-in ones replaced, by
+    /// passing a table of 256 IFunctionHandler pointers indexed by function
+    /// code to the constructor.  Any non-NULL entry takes precedence over
+    /// the built-in function, and the table can be shared between slaves.
+    /// </remarks>
     class CModbusSlave : public IFrameHandler
     {
     public:
-        CModbusSlave(ISlaveHandler* handler);
+        CModbusSlave(ISlaveHandler* handler, IFunctionHandler* const* functions = NULL);
         void frame_ready(IFramer* framer) override;
     private:
+        typedef uint8_t (CModbusSlave::*function_type)(IFramer* framer);
+        static const function_type builtin_functions[];
+        uint8_t read_coils_rsp(IFramer* framer) { return read_bit_input_rsp(framer, false); }
+        uint8_t read_discrete_inputs_rsp(IFramer* framer) { return read_bit_input_rsp(framer, true); }
+        uint8_t read_holding_registers_rsp(IFramer* framer) { return read_registers_rsp(framer, true); }
+        uint8_t read_input_registers_rsp(IFramer* framer) { return read_registers_rsp(framer, false); }
         uint8_t read_bit_input_rsp(IFramer* framer, bool discrete);
         uint8_t read_registers_rsp(IFramer* framer, bool holding);
         uint8_t write_single_coil_rsp(IFramer* framer);
         uint8_t write_single_register_rsp(IFramer* framer);
         uint8_t write_multiple_coils_rsp(IFramer* framer);
         uint8_t write_multiple_registers_rsp(IFramer* framer);
+        uint8_t mask_write_register_rsp(IFramer* framer);
+        uint8_t read_write_multiple_registers_rsp(IFramer* framer);
         ISlaveHandler* m_handler;
+        IFunctionHandler* const* m_functions;
     };
 }
+#endif
@@ -0,0 +1,129 @@
+#include "ModbusSlaveHandlerBank.h"
+#ifndef __AVR__
+namespace ModbusPotato
+{
+    CModbusSlaveHandlerBank::CModbusSlaveHandlerBank(register_type* array, size_t len)
+        :   m_array(array)
+        ,   m_len(array ? len : 0)
+        ,   m_sequence(0)
+    {
+    }
+
+    bool CModbusSlaveHandlerBank::read(uint16_t address, size_t count, uint16_t* values) const
+    {
+        if (!valid(address, count))
+            return false;
+
+        // copy the values until no write happened in the meantime
+        for (;;)
+        {
+            unsigned int sequence = m_sequence.load(std::memory_order_acquire);
+            if (sequence & 1)
+                continue; // a write is in progress
+
+            copy_out(address, count, values);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_sequence.load(std::memory_order_relaxed) == sequence)
+                return true;
+        }
+    }
+
+    bool CModbusSlaveHandlerBank::write(uint16_t address, size_t count, const uint16_t* values)
+    {
+        if (!valid(address, count))
+            return false;
+
+        unsigned int sequence = lock();
+        copy_in(address, count, values);
+        unlock(sequence);
+        return true;
+    }
+
+    modbus_exception_code::modbus_exception_code CModbusSlaveHandlerBank::read_holding_registers(uint16_t address, uint16_t count, uint16_t* result)
+    {
+        // Note: The address starts at 0 for the first holding register (40001)
+        return read(address, count, result)
+             ? modbus_exception_code::ok
+             : modbus_exception_code::illegal_data_address;
+    }
+
+    modbus_exception_code::modbus_exception_code CModbusSlaveHandlerBank::write_multiple_registers(uint16_t address, uint16_t count, const uint16_t* values)
+    {
+        return write(address, count, values)
+             ? modbus_exception_code::ok
+             : modbus_exception_code::illegal_data_address;
+    }
+
+    modbus_exception_code::modbus_exception_code CModbusSlaveHandlerBank::mask_write_register(uint16_t address, uint16_t and_mask, uint16_t or_mask)
+    {
+        if (!valid(address, 1))
+            return modbus_exception_code::illegal_data_address;
+
+        // the read-modify-write is done while holding the write lock
+        unsigned int sequence = lock();
+        uint16_t value = m_array[address].load(std::memory_order_relaxed);
+        m_array[address].store((value & and_mask) | (or_mask & ~and_mask), std::memory_order_relaxed);
+        unlock(sequence);
+
+        return modbus_exception_code::ok;
+    }
+
+    modbus_exception_code::modbus_exception_code CModbusSlaveHandlerBank::read_write_multiple_registers(uint16_t read_address, uint16_t read_n, uint16_t* read_values, uint16_t write_address, uint16_t write_n, const uint16_t* write_values)
+    {
+        if (!valid(read_address, read_n) || !valid(write_address, write_n))
+            return modbus_exception_code::illegal_data_address;
+
+        // write and read back as one transaction
+        //
+        // Note: the write values are used up before the read values are
+        // stored, as they may share the same buffer.
+        //
+        unsigned int sequence = lock();
+        copy_in(write_address, write_n, write_values);
+        copy_out(read_address, read_n, read_values);
+        unlock(sequence);
+
+        return modbus_exception_code::ok;
+    }
+
+    unsigned int CModbusSlaveHandlerBank::lock()
+    {
+        // make the sequence odd to keep out the other writers and to make the readers retry
+        unsigned int sequence = m_sequence.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            if (sequence & 1)
+            {
+                // another writer is busy
+                sequence = m_sequence.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (m_sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire, std::memory_order_relaxed))
+                break;
+        }
+
+        // keep the stores to the registers after the sequence change
+        std::atomic_thread_fence(std::memory_order_release);
+        return sequence + 1;
+    }
+
+    void CModbusSlaveHandlerBank::unlock(unsigned int sequence)
+    {
+        // publish the new values; the sequence is even again
+        m_sequence.store(sequence + 1, std::memory_order_release);
+    }
+
+    void CModbusSlaveHandlerBank::copy_in(uint16_t address, size_t count, const uint16_t* values)
+    {
+        for (register_type* p = m_array + address; count; --count)
+            (p++)->store(*values++, std::memory_order_relaxed);
+    }
+
+    void CModbusSlaveHandlerBank::copy_out(uint16_t address, size_t count, uint16_t* values) const
+    {
+        for (const register_type* p = m_array + address; count; --count)
+            *values++ = (p++)->load(std::memory_order_relaxed);
+    }
+}
+#endif
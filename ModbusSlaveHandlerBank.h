@@ -0,0 +1,68 @@
+#ifndef __ModbusSlaveHandlerBank_h__
+#define __ModbusSlaveHandlerBank_h__
+#include "ModbusInterface.h"
+#ifndef __AVR__
+#include <atomic>
+namespace ModbusPotato
+{
+    /// <summary>
+    /// This class is a slave handler for holding registers that may be
+    /// updated by other threads while the slave is serving requests.
+    /// </summary>
+    /// <remarks>
+    /// The registers are protected by a sequence lock.  Readers never block
+    /// writers and never take a lock; if a write happens while a block is
+    /// being copied out, the copy is simply retried, so every read returns
+    /// a consistent block (such as both halves of a 32 bit value).  Writers
+    /// only wait for each other, and only for as long as it takes to copy
+    /// in the values, so any number of threads may write to the same bank.
+    ///
+    /// Requests from the Modbus master are handled in the same way, with
+    /// read_holding_registers() as a reader and the write functions as
+    /// writers.  Mask Write Register and Read/Write Multiple Registers are
+    /// done atomically.
+    ///
+    /// The registers must be stored as register_type, which performs the
+    /// element accesses without tearing; on most targets it is the same
+    /// size as uint16_t and compiles to plain loads and stores.
+    /// </remarks>
+    class CModbusSlaveHandlerBank : public ISlaveHandler
+    {
+    public:
+        typedef std::atomic<uint16_t> register_type;
+
+        CModbusSlaveHandlerBank(register_type* array, size_t len);
+
+        /// <summary>
+        /// Copies a consistent block of registers out of the bank.
+        /// </summary>
+        /// <returns>
+        /// false if the range is outside of the bank.
+        /// </returns>
+        bool read(uint16_t address, size_t count, uint16_t* values) const;
+
+        /// <summary>
+        /// Copies a block of registers into the bank, as a single update.
+        /// </summary>
+        /// <returns>
+        /// false if the range is outside of the bank.
+        /// </returns>
+        bool write(uint16_t address, size_t count, const uint16_t* values);
+
+        modbus_exception_code::modbus_exception_code read_holding_registers(uint16_t address, uint16_t count, uint16_t* result) override;
+        modbus_exception_code::modbus_exception_code write_multiple_registers(uint16_t address, uint16_t count, const uint16_t* values) override;
+        modbus_exception_code::modbus_exception_code mask_write_register(uint16_t address, uint16_t and_mask, uint16_t or_mask) override;
+        modbus_exception_code::modbus_exception_code read_write_multiple_registers(uint16_t read_address, uint16_t read_n, uint16_t* read_values, uint16_t write_address, uint16_t write_n, const uint16_t* write_values) override;
+    private:
+        bool valid(uint16_t address, size_t count) const { return count <= m_len && address < m_len && (size_t)address + count <= m_len; }
+        unsigned int lock();
+        void unlock(unsigned int sequence);
+        void copy_in(uint16_t address, size_t count, const uint16_t* values);
+        void copy_out(uint16_t address, size_t count, uint16_t* values) const;
+        register_type* m_array;
+        size_t m_len;
+        std::atomic<unsigned int> m_sequence; // odd while a write is in progress
+    };
+}
+#endif
+#endif
@@ -0,0 +1,54 @@
+#include "ModbusSlaveHandlerCoils.h"
+#include "ModbusUtil.h"
+namespace ModbusPotato
+{
+    CModbusSlaveHandlerCoils::CModbusSlaveHandlerCoils(uint8_t* coils, size_t coils_n, const uint8_t* inputs, size_t inputs_n)
+        :   m_coils(coils)
+        ,   m_coils_n(coils ? coils_n : 0)
+        ,   m_inputs(inputs)
+        ,   m_inputs_n(inputs ? inputs_n : 0)
+    {
+    }
+
+    modbus_exception_code::modbus_exception_code CModbusSlaveHandlerCoils::read_coils(uint16_t address, uint16_t count, uint8_t* result)
+    {
+        // check to make sure the address and count are valid
+        //
+        // Note: The address starts at 0 for the first coil (00001)
+        //
+        if (count > m_coils_n || address >= m_coils_n || (size_t)address + count > m_coils_n)
+            return modbus_exception_code::illegal_data_address;
+
+        // copy the bits
+        extract_bits(m_coils, address, count, result);
+
+        return modbus_exception_code::ok;
+    }
+
+    modbus_exception_code::modbus_exception_code CModbusSlaveHandlerCoils::read_discrete_inputs(uint16_t address, uint16_t count, uint8_t* result)
+    {
+        // check to make sure the address and count are valid
+        //
+        // Note: The address starts at 0 for the first discrete input (10001)
+        //
+        if (count > m_inputs_n || address >= m_inputs_n || (size_t)address + count > m_inputs_n)
+            return modbus_exception_code::illegal_data_address;
+
+        // copy the bits
+        extract_bits(m_inputs, address, count, result);
+
+        return modbus_exception_code::ok;
+    }
+
+    modbus_exception_code::modbus_exception_code CModbusSlaveHandlerCoils::write_multiple_coils(uint16_t address, uint16_t count, const uint8_t* values)
+    {
+        // check to make sure the address and count are valid
+        if (count > m_coils_n || address >= m_coils_n || (size_t)address + count > m_coils_n)
+            return modbus_exception_code::illegal_data_address;
+
+        // copy the bits
+        insert_bits(m_coils, address, count, values);
+
+        return modbus_exception_code::ok;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef __ModbusSlaveHandlerCoils_h__
+#define __ModbusSlaveHandlerCoils_h__
+#include "ModbusInterface.h"
+namespace ModbusPotato
+{
+    /// <summary>
+    /// This class is a slave handler for reading and writing coils and
+    /// reading discrete inputs stored in packed bit arrays.
+    /// </summary>
+    /// <remarks>
+    /// The arrays are packed 8 to a byte in the same way as the PDU, with
+    /// coil 0 (00001) in the least significant bit of the first byte.  The
+    /// bits are copied a word at a time at any bit offset, so large requests
+    /// do not cost a branch per coil.  The discrete inputs are optional.
+    /// </remarks>
+    class CModbusSlaveHandlerCoils : public ISlaveHandler
+    {
+    public:
+        CModbusSlaveHandlerCoils(uint8_t* coils, size_t coils_n, const uint8_t* inputs = NULL, size_t inputs_n = 0);
+        modbus_exception_code::modbus_exception_code read_coils(uint16_t address, uint16_t count, uint8_t* result) override;
+        modbus_exception_code::modbus_exception_code read_discrete_inputs(uint16_t address, uint16_t count, uint8_t* result) override;
+        modbus_exception_code::modbus_exception_code write_multiple_coils(uint16_t address, uint16_t count, const uint8_t* values) override;
+    private:
+        uint8_t* m_coils;
+        size_t m_coils_n;
+        const uint8_t* m_inputs;
+        size_t m_inputs_n;
+    };
+}
+#endif
@@ -0,0 +1,153 @@
+#include <string.h>
+#include "ModbusSlaveHandlerMap.h"
+namespace ModbusPotato
+{
+    CModbusSlaveHandlerMap::CModbusSlaveHandlerMap(const range* holding, size_t holding_n, const range* input, size_t input_n)
+        :   m_holding(holding)
+        ,   m_holding_n(holding ? holding_n : 0)
+        ,   m_input(input)
+        ,   m_input_n(input ? input_n : 0)
+    {
+    }
+
+    bool CModbusSlaveHandlerMap::valid(const range* ranges, size_t n)
+    {
+        unsigned long end = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            const range& r = ranges[i];
+            if (!r.count || (!r.data && !r.handler))
+                return false;
+            if (i && r.address < end)
+                return false; // not sorted, or overlaps with the previous range
+            end = (unsigned long)r.address + r.count;
+            if (end > 0x10000)
+                return false;
+        }
+        return true;
+    }
+
+    const CModbusSlaveHandlerMap::range* CModbusSlaveHandlerMap::find(const range* ranges, size_t n, uint16_t address)
+    {
+        // find the last range that starts at or before the address
+        size_t lo = 0, hi = n;
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            if (ranges[mid].address <= address)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (!lo)
+            return NULL;
+
+        // make sure the address is inside of it
+        const range* r = &ranges[lo - 1];
+        return (unsigned long)address < (unsigned long)r->address + r->count ? r : NULL;
+    }
+
+    bool CModbusSlaveHandlerMap::mapped(const range* ranges, size_t n, uint16_t address, uint16_t count)
+    {
+        const range* r = find(ranges, n, address);
+        if (!r)
+            return false;
+
+        // the following ranges must continue without a gap until the end of the request
+        const range* last = ranges + n;
+        unsigned long end = (unsigned long)address + count;
+        for (;;)
+        {
+            unsigned long r_end = (unsigned long)r->address + r->count;
+            if (end <= r_end)
+                return true;
+            if (++r == last || r->address != r_end)
+                return false;
+        }
+    }
+
+    modbus_exception_code::modbus_exception_code CModbusSlaveHandlerMap::read(const range* ranges, size_t n, uint16_t address, uint16_t count, uint16_t* result, bool holding)
+    {
+        const range* r = find(ranges, n, address);
+        const range* last = ranges + n;
+        while (count)
+        {
+            if (!r || r == last || (unsigned long)address < r->address)
+                return modbus_exception_code::illegal_data_address;
+
+            // get the part of the request that falls in this range
+            uint16_t offset = address - r->address;
+            uint16_t len = r->count - offset;
+            if (len > count)
+                len = count;
+
+            if (r->data)
+            {
+                // copy the whole part at once
+                memcpy(result, r->data + offset, len * sizeof(uint16_t));
+            }
+            else
+            {
+                modbus_exception_code::modbus_exception_code ret = holding
+                    ? r->handler->read_holding_registers(address, len, result)
+                    : r->handler->read_input_registers(address, len, result);
+                if (ret)
+                    return ret;
+            }
+
+            // move on to the next range
+            address += len;
+            count -= len;
+            result += len;
+            ++r;
+        }
+        return modbus_exception_code::ok;
+    }
+
+    modbus_exception_code::modbus_exception_code CModbusSlaveHandlerMap::read_holding_registers(uint16_t address, uint16_t count, uint16_t* result)
+    {
+        // Note: The address starts at 0 for the first holding register (40001)
+        return read(m_holding, m_holding_n, address, count, result, true);
+    }
+
+    modbus_exception_code::modbus_exception_code CModbusSlaveHandlerMap::read_input_registers(uint16_t address, uint16_t count, uint16_t* result)
+    {
+        // Note: The address starts at 0 for the first input register (30001)
+        return read(m_input, m_input_n, address, count, result, false);
+    }
+
+    modbus_exception_code::modbus_exception_code CModbusSlaveHandlerMap::write_multiple_registers(uint16_t address, uint16_t count, const uint16_t* values)
+    {
+        // check the whole request first so that nothing is written if any part is unmapped
+        if (!count || !mapped(m_holding, m_holding_n, address, count))
+            return modbus_exception_code::illegal_data_address;
+
+        const range* r = find(m_holding, m_holding_n, address);
+        while (count)
+        {
+            // get the part of the request that falls in this range
+            uint16_t offset = address - r->address;
+            uint16_t len = r->count - offset;
+            if (len > count)
+                len = count;
+
+            if (r->data)
+            {
+                // copy the whole part at once
+                memcpy(r->data + offset, values, len * sizeof(uint16_t));
+            }
+            else
+            {
+                if (modbus_exception_code::modbus_exception_code ret = r->handler->write_multiple_registers(address, len, values))
+                    return ret;
+            }
+
+            // move on to the next range
+            address += len;
+            count -= len;
+            values += len;
+            ++r;
+        }
+        return modbus_exception_code::ok;
+    }
+}
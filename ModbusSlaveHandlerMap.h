@@ -0,0 +1,61 @@
+#ifndef __ModbusSlaveHandlerMap_h__
+#define __ModbusSlaveHandlerMap_h__
+#include "ModbusInterface.h"
+namespace ModbusPotato
+{
+    /// <summary>
+    /// This class is a slave handler for devices that expose several
+    /// separate ranges of holding and input registers.
+    /// </summary>
+    /// <remarks>
+    /// Each range is backed either by an array or by another slave handler,
+    /// which is called with the original register addresses.  The ranges
+    /// are looked up with a binary search, and a request that spans several
+    /// adjacent ranges is served one range at a time, so the registers in
+    /// an array are copied in a single block rather than one at a time.
+    ///
+    /// The ranges of each table must be sorted by address and must not
+    /// overlap; valid() can be used to check a table.  Any register that
+    /// is not part of a range is an illegal data address, and a write is
+    /// only performed if every register it touches is mapped.
+    /// </remarks>
+    class CModbusSlaveHandlerMap : public ISlaveHandler
+    {
+    public:
+        /// <summary>
+        /// A range of registers.
+        /// </summary>
+        /// <remarks>
+        /// If data is NULL, the requests are passed on to the handler
+        /// instead.  For input registers, the data is only read.
+        /// </remarks>
+        struct range
+        {
+            uint16_t address;
+            uint16_t count;
+            uint16_t* data;
+            ISlaveHandler* handler;
+        };
+
+        CModbusSlaveHandlerMap(const range* holding, size_t holding_n, const range* input = NULL, size_t input_n = 0);
+
+        /// <summary>
+        /// Returns true if the ranges are sorted, do not overlap and each
+        /// have either an array or a handler.
+        /// </summary>
+        static bool valid(const range* ranges, size_t n);
+
+        modbus_exception_code::modbus_exception_code read_holding_registers(uint16_t address, uint16_t count, uint16_t* result) override;
+        modbus_exception_code::modbus_exception_code read_input_registers(uint16_t address, uint16_t count, uint16_t* result) override;
+        modbus_exception_code::modbus_exception_code write_multiple_registers(uint16_t address, uint16_t count, const uint16_t* values) override;
+    private:
+        static const range* find(const range* ranges, size_t n, uint16_t address);
+        static bool mapped(const range* ranges, size_t n, uint16_t address, uint16_t count);
+        static modbus_exception_code::modbus_exception_code read(const range* ranges, size_t n, uint16_t address, uint16_t count, uint16_t* result, bool holding);
+        const range* m_holding;
+        size_t m_holding_n;
+        const range* m_input;
+        size_t m_input_n;
+    };
+}
+#endif
@@ -0,0 +1,253 @@
+#include "ModbusTCP.h"
+namespace ModbusPotato
+{
+    CModbusTCP::CModbusTCP(IStream* stream, uint8_t* buffer, size_t buffer_max)
+        :   IFramer(stream, NULL, buffer ? buffer + MBAP_LEN : NULL, buffer_max > MBAP_LEN ? buffer_max - MBAP_LEN : 0)
+        ,   m_state(state_idle)
+        ,   m_pos()
+        ,   m_len()
+        ,   m_transaction_id()
+        ,   m_next_transaction_id()
+    {
+        if (!m_stream || !m_buffer || m_buffer_max < 2)
+        {
+            m_state = state_exception;
+            return;
+        }
+    }
+
+    unsigned long CModbusTCP::poll()
+    {
+        // state machine for handling incoming data
+        //
+        // See http://www.modbus.org/docs/Modbus_Messaging_Implementation_Guide_V1_0b.pdf
+        //
+        // The header is read first, followed by exactly the number of bytes
+        // given in its length field.  Nothing past the end of the current
+        // frame is read so that any pipelined frames are left in the stream
+        // until the application has finished with the buffer.
+        //
+        // Reason for goto statements: re-evaluate switch case labels when
+        // changing states.
+        //
+        switch (m_state)
+        {
+        case state_exception: // fatal error - framer shut down
+            {
+                // do nothing
+                return 0;
+            }
+        case state_idle: // waiting for something to happen
+        case state_rx_header: // receiving the MBAP header
+idle:
+            {
+                // read the remainder of the header
+                int ec = m_stream->read(header() + m_pos, MBAP_LEN - m_pos);
+                if (ec < 0)
+                {
+                    // connection lost
+                    m_state = state_exception;
+                    m_stream->communicationStatus(false, false);
+                    return 0; // fatal exception
+                }
+                if (!ec)
+                    return 0; // waiting for an event
+
+                if (m_state == state_idle)
+                {
+                    m_state = state_rx_header;
+                    m_stream->communicationStatus(true, false);
+                }
+
+                m_pos += ec;
+                if (m_pos < MBAP_LEN)
+                    return 0; // waiting for the rest of the header
+
+                // decode the header
+                const uint8_t* mbap = header();
+                uint16_t protocol_id = ((uint16_t)mbap[2] << 8) | mbap[3];
+                uint16_t length = ((uint16_t)mbap[4] << 8) | mbap[5];
+                m_transaction_id = ((uint16_t)mbap[0] << 8) | mbap[1];
+                m_frame_address = mbap[6];
+
+                // the length includes the unit id
+                m_len = length ? length - 1 : 0;
+                m_pos = 0;
+
+                // skip any frames that are not Modbus, do not fit in the buffer or are not for us
+                if (protocol_id != 0 || !m_len || m_len > m_buffer_max
+                ||  (m_station_address && m_frame_address && m_frame_address != m_station_address))
+                {
+                    m_state = state_rx_skip;
+                    goto rx_skip;
+                }
+
+                // receive the PDU
+                m_state = state_rx_pdu;
+                goto rx_pdu;
+            }
+        case state_rx_pdu: // receiving the PDU
+rx_pdu:
+            {
+                // read the remainder of the PDU
+                int ec = m_stream->read(m_buffer + m_pos, m_len - m_pos);
+                if (ec < 0)
+                {
+                    // connection lost
+                    m_state = state_exception;
+                    m_stream->communicationStatus(false, false);
+                    return 0; // fatal exception
+                }
+
+                m_pos += ec;
+                if (m_pos < m_len)
+                    return 0; // waiting for the rest of the PDU
+
+                // move to the 'Frame Ready' state
+                m_buffer_len = m_len;
+                m_state = state_frame_ready;
+                m_stream->communicationStatus(false, false);
+
+                // execute the callback
+                if (m_handler)
+                    m_handler->frame_ready(this);
+
+                // evaluate the switch statement again in case something has changed
+                return poll(); // jump to the start of the function to re-evalutate entire switch statement
+            }
+        case state_rx_skip: // discarding an unwanted PDU
+rx_skip:
+            {
+                // dump the remainder of the PDU
+                if (m_pos < m_len)
+                {
+                    int ec = m_stream->read(NULL, m_len - m_pos);
+                    if (ec < 0)
+                    {
+                        // connection lost
+                        m_state = state_exception;
+                        m_stream->communicationStatus(false, false);
+                        return 0; // fatal exception
+                    }
+
+                    m_pos += ec;
+                    if (m_pos < m_len)
+                        return 0; // waiting for the rest of the PDU
+                }
+
+                // done, go back to the idle state
+                m_pos = 0;
+                m_state = state_idle;
+                m_stream->communicationStatus(false, false);
+                goto idle;
+            }
+        case state_frame_ready: // waiting for the application layer to process the frame
+        case state_queue: // waiting for the application layer to create frame for transmission
+            {
+                // any further requests stay in the stream until we are done
+                return 0; // waiting for user
+            }
+        case state_tx: // transmitting the header and PDU
+            {
+                // send the next chunk
+                int ec = m_stream->write(header() + m_pos, m_len - m_pos);
+                if (ec < 0)
+                {
+                    // connection lost
+                    m_state = state_exception;
+                    m_stream->communicationStatus(false, false);
+                    return 0; // fatal exception
+                }
+
+                m_pos += ec;
+                if (m_pos < m_len)
+                    return 0; // waiting for room in the write buffer
+
+                // TX done! go to the idle state
+                m_pos = 0;
+                m_state = state_idle;
+                m_stream->communicationStatus(false, false);
+                goto idle;
+            }
+        }
+
+        // if we get here, then something terrible has happened such as memory corruption
+        m_state = state_exception;
+        return 0;
+    }
+
+    bool CModbusTCP::begin_send()
+    {
+        switch (m_state)
+        {
+        case state_queue:
+            {
+                return true; // already in the queue state
+            }
+        case state_idle:
+            {
+                // a new request; allocate a new transaction id
+                m_transaction_id = m_next_transaction_id++;
+                m_state = state_queue;
+                return true;
+            }
+        case state_frame_ready:
+            {
+                // a response; the transaction id of the request is echoed back
+                m_state = state_queue;
+                return true;
+            }
+        default:
+                return false; // not ready to send
+        }
+    }
+
+    void CModbusTCP::send()
+    {
+        // sanity check
+        if (m_state != state_queue || m_buffer_len > buffer_max())
+        {
+            // invalid state or buffer overflow - enter the 'exception' state
+            m_state = state_exception;
+            return;
+        }
+
+        // fill in the header in front of the PDU
+        uint16_t length = (uint16_t)(m_buffer_len + 1);
+        uint8_t* mbap = header();
+        mbap[0] = (uint8_t)(m_transaction_id >> 8);
+        mbap[1] = (uint8_t)m_transaction_id;
+        mbap[2] = 0; // protocol id
+        mbap[3] = 0;
+        mbap[4] = (uint8_t)(length >> 8);
+        mbap[5] = (uint8_t)length;
+        mbap[6] = m_frame_address;
+
+        // enter the transmit state
+        m_pos = 0;
+        m_len = MBAP_LEN + m_buffer_len;
+        m_state = state_tx;
+        m_stream->communicationStatus(false, true);
+    }
+
+    void CModbusTCP::finished()
+    {
+        switch (m_state)
+        {
+        case state_frame_ready: // received
+        case state_queue: // aborting begin_send()
+            {
+                // acknowledge or abort the user lock on the buffer
+                m_pos = 0;
+                m_state = state_idle;
+                return; // ok
+            }
+        default:
+            {
+                // invalid state
+                m_state = state_exception;
+                return; // invalid state - enter the 'exception' state
+            }
+        }
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef __ModbusPotato_ModbusTCP_h__
+#define __ModbusPotato_ModbusTCP_h__
+#include "ModbusInterface.h"
+#define MODBUS_TCP_BUFFER_SIZE (7 + 253) // MBAP header + maximum PDU length
+namespace ModbusPotato
+{
+    /// <summary>
+    /// This class handles the TCP based protocol for Modbus.
+    /// </summary>
+    /// <remarks>
+    /// See the IFramer interface for a complete description of the public
+    /// methods.
+    ///
+    /// Each frame is preceded by the 7 byte MBAP header:
+    ///
+    ///  transaction id (2 bytes)
+    ///  protocol id (2 bytes, always 0)
+    ///  length (2 bytes, unit id + PDU)
+    ///  unit id (1 byte)
+    ///
+    /// Since the header carries the length of the frame, no inter-character
+    /// or inter-frame timing is used and poll() never returns a timeout.
+    /// The unit id is mapped onto frame_address().  On a server, leave the
+    /// station address at 0 so that requests to any unit id are answered.
+    ///
+    /// The first MBAP_LEN bytes of the buffer passed to the constructor are
+    /// reserved for the header so that a frame can be sent in a single
+    /// write() without copying; buffer() points just past them.  Use a
+    /// buffer of MODBUS_TCP_BUFFER_SIZE bytes to hold the largest PDU.
+    ///
+    /// The stream must deliver the bytes of the TCP connection in order, and
+    /// its read() method should return -1 once the connection is closed.  A
+    /// read or write error is treated as a closed connection and puts the
+    /// framer into the exception state (see exception()).
+    /// </remarks>
+    class CModbusTCP : public IFramer
+    {
+    public:
+        enum
+        {
+            MBAP_LEN = 7,
+        };
+
+        /// <summary>
+        /// Constructor for the TCP framer.
+        /// </summary>
+        CModbusTCP(IStream* stream, uint8_t* buffer, size_t buffer_max);
+
+        /// <summary>
+        /// Returns the transaction id of the frame in the buffer.
+        /// </summary>
+        /// <remarks>
+        /// When a frame is received, this is the transaction id from its
+        /// header, which is echoed back if a response is sent.  When a new
+        /// frame is started from the idle state with begin_send(), a new
+        /// transaction id is allocated.
+        /// </remarks>
+        uint16_t transaction_id() const { return m_transaction_id; }
+
+        /// <summary>
+        /// Overrides the transaction id of the frame to be sent.
+        /// </summary>
+        /// <remarks>
+        /// This must be called between begin_send() and send().
+        /// </remarks>
+        void set_transaction_id(uint16_t id) { m_transaction_id = id; }
+
+        unsigned long poll();
+        bool begin_send();
+        void send();
+        void finished();
+        bool idle() const { return m_state == state_idle; }
+        bool frame_ready() const { return m_state == state_frame_ready; }
+
+        /// <summary>
+        /// Indicates if the framer has shut down due to a stream error.
+        /// </summary>
+        /// <remarks>
+        /// The connection should be closed when this happens.
+        /// </remarks>
+        bool exception() const { return m_state == state_exception; }
+    private:
+        enum state_type
+        {
+            state_exception,
+            state_idle,
+            state_frame_ready,
+            state_queue,
+            state_rx_header,
+            state_rx_pdu,
+            state_rx_skip,
+            state_tx,
+        };
+        uint8_t* header() { return m_buffer - MBAP_LEN; }
+        state_type m_state;
+        size_t m_pos, m_len;
+        uint16_t m_transaction_id, m_next_transaction_id;
+    };
+}
+#endif
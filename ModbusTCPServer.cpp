@@ -0,0 +1,308 @@
+#include "ModbusTCPServer.h"
+#ifdef __linux__
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+namespace ModbusPotato
+{
+    CModbusTCPServer::CConnection::CConnection()
+        :   m_fd(-1)
+        ,   m_readable()
+        ,   m_eof()
+        ,   m_rx_pos()
+        ,   m_rx_len()
+        ,   m_framer(this, m_buffer, sizeof(m_buffer))
+        ,   m_next_free()
+    {
+    }
+
+    void CModbusTCPServer::CConnection::open(int fd, IFrameHandler* handler)
+    {
+        m_fd = fd;
+        m_readable = true;
+        m_eof = false;
+        m_rx_pos = 0;
+        m_rx_len = 0;
+
+        // start over with a fresh framer
+        m_framer = CModbusTCP(this, m_buffer, sizeof(m_buffer));
+        m_framer.set_handler(handler);
+    }
+
+    void CModbusTCPServer::CConnection::close()
+    {
+        if (m_fd >= 0)
+        {
+            // Note: closing the socket also removes it from the epoll set
+            ::close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    bool CModbusTCPServer::CConnection::fill()
+    {
+        if (!m_readable)
+            return false; // nothing new since the last edge
+
+        // move any unread data to the front of the buffer
+        if (m_rx_pos)
+        {
+            memmove(m_rx, m_rx + m_rx_pos, m_rx_len - m_rx_pos);
+            m_rx_len -= m_rx_pos;
+            m_rx_pos = 0;
+        }
+
+        size_t room = sizeof(m_rx) - m_rx_len;
+        if (!room)
+            return false; // wait for the framer to catch up
+
+        // read as much as will fit in a single call
+        ssize_t ec = recv(m_fd, m_rx + m_rx_len, room, 0);
+        if (ec > 0)
+        {
+            // a short read means that the socket has been drained (see epoll(7))
+            m_rx_len += ec;
+            if ((size_t)ec < room)
+                m_readable = false;
+            return true;
+        }
+        if (ec < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            m_readable = false;
+            return false;
+        }
+        if (ec < 0 && errno == EINTR)
+            return true; // try again
+
+        // connection closed or failed; let the framer drain what is left
+        m_readable = false;
+        m_eof = true;
+        return true;
+    }
+
+    int CModbusTCPServer::CConnection::read(uint8_t* buffer, size_t buffer_size)
+    {
+        if (!buffer_size)
+            return 0;
+
+        size_t len = m_rx_len - m_rx_pos;
+        if (!len)
+            return m_eof ? -1 : 0;
+        if (len > buffer_size)
+            len = buffer_size;
+
+        // if there is no buffer provided, then the data is dumped
+        if (buffer)
+            memcpy(buffer, m_rx + m_rx_pos, len);
+        m_rx_pos += len;
+        return (int)len;
+    }
+
+    int CModbusTCPServer::CConnection::write(uint8_t* buffer, size_t len)
+    {
+        if (!len)
+            return 0;
+
+        ssize_t ec = send(m_fd, buffer, len, MSG_NOSIGNAL);
+        if (ec < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        return (int)ec;
+    }
+
+    CModbusTCPServer::CModbusTCPServer(IFrameHandler* handler, size_t max_connections)
+        :   m_handler(handler)
+        ,   m_connections(new CConnection[max_connections])
+        ,   m_free()
+        ,   m_max_connections(max_connections)
+        ,   m_connection_count()
+        ,   m_listen_fd(-1)
+        ,   m_epoll_fd(-1)
+    {
+        // chain all of the connections into the free list
+        for (size_t i = max_connections; i; --i)
+        {
+            m_connections[i - 1].m_next_free = m_free;
+            m_free = &m_connections[i - 1];
+        }
+    }
+
+    CModbusTCPServer::~CModbusTCPServer()
+    {
+        close();
+        delete[] m_connections;
+    }
+
+    bool CModbusTCPServer::listen(uint16_t port, const char* address)
+    {
+        close();
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+
+        // Note: ModbusPotato::htons() always swaps, so the port is stored in
+        // network byte order by hand.
+        //
+        uint8_t* sin_port = (uint8_t*)&addr.sin_port;
+        sin_port[0] = (uint8_t)(port >> 8);
+        sin_port[1] = (uint8_t)port;
+        if (address && inet_pton(AF_INET, address, &addr.sin_addr) != 1)
+        {
+            errno = EINVAL;
+            return false;
+        }
+
+        int one = 1;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = NULL; // the listening socket
+
+        if ((m_epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0
+        ||  (m_listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0
+        ||  setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0
+        ||  bind(m_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+        ||  ::listen(m_listen_fd, SOMAXCONN) != 0
+        ||  epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_listen_fd, &ev) != 0)
+        {
+            int ec = errno;
+            close();
+            errno = ec;
+            return false;
+        }
+
+        return true;
+    }
+
+    void CModbusTCPServer::close()
+    {
+        for (size_t i = 0; i < m_max_connections; ++i)
+        {
+            if (m_connections[i].m_fd >= 0)
+                release(&m_connections[i]);
+        }
+        if (m_listen_fd >= 0)
+        {
+            ::close(m_listen_fd);
+            m_listen_fd = -1;
+        }
+        if (m_epoll_fd >= 0)
+        {
+            ::close(m_epoll_fd);
+            m_epoll_fd = -1;
+        }
+    }
+
+    int CModbusTCPServer::poll(int timeout)
+    {
+        if (m_epoll_fd < 0)
+        {
+            errno = EBADF;
+            return -1;
+        }
+
+        struct epoll_event events[max_events];
+        int count = epoll_wait(m_epoll_fd, events, max_events, timeout);
+        if (count < 0)
+            return errno == EINTR ? 0 : -1;
+
+        for (int i = 0; i < count; ++i)
+        {
+            CConnection* connection = (CConnection*)events[i].data.ptr;
+            if (!connection)
+            {
+                accept();
+                continue;
+            }
+
+            // new data, a hang up or an error; in all cases the socket must be read again
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                connection->m_readable = true;
+
+            service(connection);
+        }
+
+        return count;
+    }
+
+    void CModbusTCPServer::accept()
+    {
+        // accept everything in the backlog, as we will not be told again
+        for (;;)
+        {
+            int fd = accept4(m_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                return; // drained, or out of file descriptors
+            }
+
+            // reject the connection if the pool is exhausted
+            if (!m_free)
+            {
+                ::close(fd);
+                continue;
+            }
+
+            // responses are sent as a single write, so there is nothing to gain from Nagle's algorithm
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            CConnection* connection = m_free;
+            m_free = connection->m_next_free;
+            connection->open(fd, m_handler);
+            m_connection_count++;
+
+            // Note: if data arrived before the socket was added, the first edge is reported right away
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.ptr = connection;
+            if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+                release(connection);
+        }
+    }
+
+    void CModbusTCPServer::service(CConnection* connection)
+    {
+        // alternate between reading the socket and running the framer until neither makes progress
+        //
+        // Note: the framer only takes whole frames out of the receive buffer
+        // while it is idle, and each frame is handled synchronously by the
+        // handler, so several pipelined requests in one read are answered in
+        // one go.
+        //
+        for (;;)
+        {
+            bool filled = connection->fill();
+            size_t pos = connection->m_rx_pos;
+
+            connection->m_framer.poll();
+            if (connection->m_framer.exception())
+            {
+                // connection lost or protocol error
+                release(connection);
+                return;
+            }
+
+            if (!filled && connection->m_rx_pos == pos)
+                return; // waiting for the next edge
+        }
+    }
+
+    void CModbusTCPServer::release(CConnection* connection)
+    {
+        connection->close();
+        connection->m_next_free = m_free;
+        m_free = connection;
+        m_connection_count--;
+    }
+}
+#endif
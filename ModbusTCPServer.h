@@ -0,0 +1,115 @@
+#ifndef __ModbusTCPServer_h__
+#define __ModbusTCPServer_h__
+#include "ModbusTCP.h"
+#ifdef __linux__
+namespace ModbusPotato
+{
+    /// <summary>
+    /// This class serves Modbus TCP clients from a single epoll loop.
+    /// </summary>
+    /// <remarks>
+    /// Each accepted connection gets its own CModbusTCP framer and buffers
+    /// from a pool allocated up front, so the memory used is bounded by
+    /// max_connections.  When the pool is exhausted, new connections are
+    /// closed as soon as they are accepted.
+    ///
+    /// Complete frames from every connection are dispatched to the same
+    /// handler, which would normally be a CModbusSlave instance.  The
+    /// handler is called from within poll(), one frame at a time.
+    ///
+    /// The sockets are registered edge-triggered; each readiness event
+    /// reads as much as fits into the connection's receive buffer with a
+    /// single recv() call, and the framer then takes whole frames out of
+    /// it.
+    /// </remarks>
+    class CModbusTCPServer
+    {
+    public:
+        enum
+        {
+            rx_buffer_size = 512, // per connection receive buffer, in bytes
+            max_events = 64, // maximum number of events handled per epoll_wait() call
+        };
+
+        CModbusTCPServer(IFrameHandler* handler, size_t max_connections);
+        ~CModbusTCPServer();
+
+        /// <summary>
+        /// Starts listening on the given port.
+        /// </summary>
+        /// <returns>
+        /// true if successful, or false if the socket could not be created,
+        /// in which case errno is set.
+        /// </returns>
+        /// <remarks>
+        /// If address is NULL, all interfaces are used.
+        /// </remarks>
+        bool listen(uint16_t port, const char* address = NULL);
+
+        /// <summary>
+        /// Closes the listening socket and all connections.
+        /// </summary>
+        void close();
+
+        /// <summary>
+        /// Waits for and handles socket events.
+        /// </summary>
+        /// <returns>
+        /// The number of events handled, or -1 on error, in which case errno
+        /// is set.
+        /// </returns>
+        /// <remarks>
+        /// The timeout is in milliseconds; -1 waits forever and 0 returns
+        /// immediately.
+        /// </remarks>
+        int poll(int timeout);
+
+        /// <summary>
+        /// Returns the epoll file descriptor, or -1 if not listening.
+        /// </summary>
+        /// <remarks>
+        /// The descriptor becomes readable when poll() has work to do, so it
+        /// can be nested inside another event loop.
+        /// </remarks>
+        int fd() const { return m_epoll_fd; }
+
+        /// <summary>
+        /// Returns the number of open client connections.
+        /// </summary>
+        size_t connection_count() const { return m_connection_count; }
+    private:
+        class CConnection : public IStream
+        {
+        public:
+            CConnection();
+            void open(int fd, IFrameHandler* handler);
+            void close();
+            bool fill();
+            virtual int read(uint8_t* buffer, size_t buffer_size);
+            virtual int write(uint8_t* buffer, size_t len);
+            virtual void txEnable(bool) {}
+            virtual bool writeComplete() { return true; }
+            virtual void communicationStatus(bool, bool) {}
+            int m_fd;
+            bool m_readable; // the socket may have more data since the last edge
+            bool m_eof; // the remote end closed the connection
+            size_t m_rx_pos, m_rx_len;
+            uint8_t m_rx[rx_buffer_size];
+            uint8_t m_buffer[MODBUS_TCP_BUFFER_SIZE];
+            CModbusTCP m_framer;
+            CConnection* m_next_free;
+        };
+        CModbusTCPServer(const CModbusTCPServer&);
+        CModbusTCPServer& operator=(const CModbusTCPServer&);
+        void accept();
+        void service(CConnection* connection);
+        void release(CConnection* connection);
+        IFrameHandler* m_handler;
+        CConnection* m_connections;
+        CConnection* m_free;
+        size_t m_max_connections, m_connection_count;
+        int m_listen_fd, m_epoll_fd;
+    };
+}
+#endif
+#endif
@@ -34,9 +34,58 @@ namespace ModbusPotato
             read_input_registers = 0x04,
             write_single_coil = 0x05,
             write_single_register = 0x06,
+            read_exception_status = 0x07,
+            diagnostics = 0x08,
+            get_comm_event_counter = 0x0b,
+            get_comm_event_log = 0x0c,
             write_multiple_coils = 0x0f,
             write_multiple_registers = 0x10,
+            report_server_id = 0x11,
+            read_file_record = 0x14,
+            write_file_record = 0x15,
+            mask_write_register = 0x16,
             read_write_multiple_registers = 0x17,
+            read_fifo_queue = 0x18,
+            encapsulated_interface_transport = 0x2b,
+        };
+    }
+
+    namespace data_type
+    {
+        /// <summary>
+        /// Types of values stored in one or more consecutive registers.
+        /// </summary>
+        enum data_type
+        {
+            uint16,     // 1 register
+            int16,      // 1 register
+            uint32,     // 2 registers
+            int32,      // 2 registers
+            float32,    // 2 registers, IEEE 754 single precision
+            uint64,     // 4 registers
+            int64,      // 4 registers
+            float64,    // 4 registers, IEEE 754 double precision
+        };
+    }
+
+    namespace word_order
+    {
+        /// <summary>
+        /// Order of the bytes of a value in its registers.
+        /// </summary>
+        /// <remarks>
+        /// The bytes of a 32 bit value are named A (the most significant)
+        /// through D, and each pair of letters is one register, in order.
+        /// For 64 bit values, cdab reverses the order of all 4 registers,
+        /// and badc and dcba also swap the bytes within each register.  A
+        /// 16 bit value is only affected by the byte swap.
+        /// </remarks>
+        enum word_order
+        {
+            abcd,       // big-endian, as in the Modbus specification
+            cdab,       // registers swapped
+            badc,       // bytes swapped within each register
+            dcba,       // little-endian
         };
     }
 
@@ -1,4 +1,30 @@
+#include <string.h>
 #include "ModbusUtil.h"
+#if !defined(__AVR__) && (defined(_MSC_VER) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__))
+#define MODBUS_PACKED_BITS_WORDS // 8 bits at a time using 64 bit arithmetic
+#endif
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#define PDU_TABLE_ATTR PROGMEM
+#define PDU_TABLE_READ(entry) pgm_read_byte(&(entry))
+#else
+#define PDU_TABLE_ATTR
+#define PDU_TABLE_READ(entry) (entry)
+#endif
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define MODBUS_REGISTERS_NATIVE // the host byte order is the same as the PDU
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MODBUS_SIMD_SSE2
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MODBUS_SIMD_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MODBUS_SIMD_NEON
+#endif
 namespace ModbusPotato
 {
 
@@ -24,6 +50,111 @@ pdu_len (uint8_t station_address,
 
 /* ----------------------------------------------------------------------- */
 
+// The length of a PDU, including the CRC, is described by one byte per
+// function code: the low nibble is the fixed part of the length and the
+// high nibble is the position of the byte count that is added to it, or 0
+// if there is none.  A descriptor of 0 means that the length is not known,
+// which leaves it up to the framer to find the end of the frame.
+//
+// The diagnostics and encapsulated interface transport functions are not
+// described, as the length of their data depends on the sub-function.
+
+constexpr uint8_t
+pdu_descriptor (size_t fixed,
+                size_t pos = 0)
+{ return (uint8_t)(pos << 4 | fixed); }
+
+constexpr uint8_t
+pdu_req_descriptor (unsigned int func)
+{
+    return func == function_code::read_coil_status              ? pdu_descriptor(pdu_len_req_read_coil_status              ( ))
+         : func == function_code::read_discrete_input_status    ? pdu_descriptor(pdu_len_req_read_discrete_input_status    ( ))
+         : func == function_code::read_holding_registers        ? pdu_descriptor(pdu_len_req_read_holding_registers        ( ))
+         : func == function_code::read_input_registers          ? pdu_descriptor(pdu_len_req_read_input_registers          ( ))
+         : func == function_code::write_single_coil             ? pdu_descriptor(pdu_len_req_write_single_coil             ( ))
+         : func == function_code::write_single_register         ? pdu_descriptor(pdu_len_req_write_single_register         ( ))
+         : func == function_code::read_exception_status         ? pdu_descriptor(PDU_LEN_FUNCTION + PDU_LEN_CRC)
+         : func == function_code::get_comm_event_counter        ? pdu_descriptor(PDU_LEN_FUNCTION + PDU_LEN_CRC)
+         : func == function_code::get_comm_event_log            ? pdu_descriptor(PDU_LEN_FUNCTION + PDU_LEN_CRC)
+         : func == function_code::write_multiple_coils          ? pdu_descriptor(pdu_len_req_write_multiple_coils          (0), 5)
+         : func == function_code::write_multiple_registers      ? pdu_descriptor(pdu_len_req_write_multiple_registers      (0), 5)
+         : func == function_code::report_server_id              ? pdu_descriptor(PDU_LEN_FUNCTION + PDU_LEN_CRC)
+         : func == function_code::read_file_record              ? pdu_descriptor(PDU_LEN_FUNCTION + PDU_LEN_BYTE_COUNT + PDU_LEN_CRC, 1)
+         : func == function_code::write_file_record             ? pdu_descriptor(PDU_LEN_FUNCTION + PDU_LEN_BYTE_COUNT + PDU_LEN_CRC, 1)
+         : func == function_code::mask_write_register           ? pdu_descriptor(pdu_len_req_mask_write_register           ( ))
+         : func == function_code::read_write_multiple_registers ? pdu_descriptor(pdu_len_req_read_write_multiple_registers (0), 9)
+         : func == function_code::read_fifo_queue               ? pdu_descriptor(PDU_LEN_FUNCTION + PDU_LEN_ADDRESS + PDU_LEN_CRC)
+         : 0;
+}
+
+constexpr uint8_t
+pdu_rsp_descriptor (unsigned int func)
+{
+    // Note: the byte count of the FIFO queue has 16 bits, but it can not
+    // be more than 64, so only the low byte is used.
+    return func &  0x80                                         ? pdu_descriptor(PDU_LEN_FUNCTION + 1 /* exception code */ + PDU_LEN_CRC)
+         : func == function_code::read_coil_status              ? pdu_descriptor(pdu_len_rsp_read_coil_status              (0), 1)
+         : func == function_code::read_discrete_input_status    ? pdu_descriptor(pdu_len_rsp_read_discrete_input_status    (0), 1)
+         : func == function_code::read_holding_registers        ? pdu_descriptor(pdu_len_rsp_read_holding_registers        (0), 1)
+         : func == function_code::read_input_registers          ? pdu_descriptor(pdu_len_rsp_read_input_registers          (0), 1)
+         : func == function_code::write_single_coil             ? pdu_descriptor(pdu_len_rsp_write_single_coil             ( ))
+         : func == function_code::write_single_register         ? pdu_descriptor(pdu_len_rsp_write_single_register         ( ))
+         : func == function_code::read_exception_status         ? pdu_descriptor(PDU_LEN_FUNCTION + 1 /* status */ + PDU_LEN_CRC)
+         : func == function_code::get_comm_event_counter        ? pdu_descriptor(PDU_LEN_FUNCTION + 2 /* status */ + 2 /* event count */ + PDU_LEN_CRC)
+         : func == function_code::get_comm_event_log            ? pdu_descriptor(PDU_LEN_FUNCTION + PDU_LEN_BYTE_COUNT + PDU_LEN_CRC, 1)
+         : func == function_code::write_multiple_coils          ? pdu_descriptor(pdu_len_rsp_write_multiple_coils          ( ))
+         : func == function_code::write_multiple_registers      ? pdu_descriptor(pdu_len_rsp_write_multiple_registers      ( ))
+         : func == function_code::report_server_id              ? pdu_descriptor(PDU_LEN_FUNCTION + PDU_LEN_BYTE_COUNT + PDU_LEN_CRC, 1)
+         : func == function_code::read_file_record              ? pdu_descriptor(PDU_LEN_FUNCTION + PDU_LEN_BYTE_COUNT + PDU_LEN_CRC, 1)
+         : func == function_code::write_file_record             ? pdu_descriptor(PDU_LEN_FUNCTION + PDU_LEN_BYTE_COUNT + PDU_LEN_CRC, 1)
+         : func == function_code::mask_write_register           ? pdu_descriptor(pdu_len_rsp_mask_write_register           ( ))
+         : func == function_code::read_write_multiple_registers ? pdu_descriptor(pdu_len_rsp_read_write_multiple_registers (0), 1)
+         : func == function_code::read_fifo_queue               ? pdu_descriptor(PDU_LEN_FUNCTION + 2 /* byte count */ + PDU_LEN_CRC, 2)
+         : 0;
+}
+
+static_assert(pdu_len_req_read_write_multiple_registers(0) < 16, "PDU length does not fit in a descriptor");
+
+#define PDU_TABLE_ROW(f, row) \
+    f(row + 0x0), f(row + 0x1), f(row + 0x2), f(row + 0x3), f(row + 0x4), f(row + 0x5), f(row + 0x6), f(row + 0x7), \
+    f(row + 0x8), f(row + 0x9), f(row + 0xa), f(row + 0xb), f(row + 0xc), f(row + 0xd), f(row + 0xe), f(row + 0xf)
+#define PDU_TABLE(f) \
+    PDU_TABLE_ROW(f, 0x00), PDU_TABLE_ROW(f, 0x10), PDU_TABLE_ROW(f, 0x20), PDU_TABLE_ROW(f, 0x30), \
+    PDU_TABLE_ROW(f, 0x40), PDU_TABLE_ROW(f, 0x50), PDU_TABLE_ROW(f, 0x60), PDU_TABLE_ROW(f, 0x70), \
+    PDU_TABLE_ROW(f, 0x80), PDU_TABLE_ROW(f, 0x90), PDU_TABLE_ROW(f, 0xa0), PDU_TABLE_ROW(f, 0xb0), \
+    PDU_TABLE_ROW(f, 0xc0), PDU_TABLE_ROW(f, 0xd0), PDU_TABLE_ROW(f, 0xe0), PDU_TABLE_ROW(f, 0xf0)
+
+static constexpr uint8_t pdu_req_table[256] PDU_TABLE_ATTR = { PDU_TABLE(pdu_req_descriptor) };
+static constexpr uint8_t pdu_rsp_table[256] PDU_TABLE_ATTR = { PDU_TABLE(pdu_rsp_descriptor) };
+
+// returns the length of a PDU from its descriptor and byte count
+static inline size_t
+pdu_len_desc (uint8_t desc,
+              size_t byte_count)
+{
+    if (!desc)
+        return -1;
+    if (!(desc >> 4))
+        return desc & 0x0f;
+    if (!byte_count)
+        return -1;
+    return (desc & 0x0f) + byte_count;
+}
+
+// returns the length of the PDU in the buffer from its descriptor
+static inline size_t
+pdu_len_desc (uint8_t desc,
+              const uint8_t* buffer,
+              size_t buffer_len)
+{
+    const size_t pos = desc >> 4;
+    const size_t byte_count = (pos && buffer_len > pos) ? buffer[pos] : 0;
+
+    return pdu_len_desc(desc, byte_count);
+}
+
+/* ----------------------------------------------------------------------- */
+
 size_t
 pdu_len_req (const uint8_t* buffer,
              size_t buffer_len)
@@ -31,25 +162,7 @@ pdu_len_req (const uint8_t* buffer,
     if (buffer_len == 0)
         return -1;
 
-    const auto func = static_cast<function_code::function_code>(buffer[0]);
-
-    size_t pos = -1;
-    switch (func)
-    {
-    case function_code::read_coil_status             : pos = -1; break;
-    case function_code::read_discrete_input_status   : pos = -1; break;
-    case function_code::read_holding_registers       : pos = -1; break;
-    case function_code::read_input_registers         : pos = -1; break;
-    case function_code::write_single_coil            : pos = -1; break;
-    case function_code::write_single_register        : pos = -1; break;
-    case function_code::write_multiple_coils         : pos =  5; break;
-    case function_code::write_multiple_registers     : pos =  5; break;
-    case function_code::read_write_multiple_registers: pos =  9; break;
-    }
-
-    const size_t byte_count = (buffer_len > pos) ? buffer[pos] : 0;
-
-    return pdu_len_req(func, byte_count);
+    return pdu_len_desc(PDU_TABLE_READ(pdu_req_table[buffer[0]]), buffer, buffer_len);
 }
 
 size_t
@@ -59,67 +172,669 @@ pdu_len_rsp (const uint8_t* buffer,
     if (buffer_len == 0)
         return -1;
 
-    const auto func = static_cast<function_code::function_code>(buffer[0]);
+    return pdu_len_desc(PDU_TABLE_READ(pdu_rsp_table[buffer[0]]), buffer, buffer_len);
+}
 
-    size_t pos = -1;
-    switch (func)
+/* ----------------------------------------------------------------------- */
+
+size_t
+pdu_len_req (function_code::function_code func,
+             size_t bc) // byte count
+{
+    return pdu_len_desc(PDU_TABLE_READ(pdu_req_table[func & 0xff]), bc);
+}
+
+size_t
+pdu_len_rsp (function_code::function_code func,
+             size_t bc) // byte count
+{
+    return pdu_len_desc(PDU_TABLE_READ(pdu_rsp_table[func & 0xff]), bc);
+}
+
+/* ----------------------------------------------------------------------- */
+
+#ifdef MODBUS_SIMD_AVX2
+// swaps the bytes of 16 registers at a time, returning the number converted
+static MODBUS_SIMD_AVX2 size_t
+convert_registers_avx2 (uint8_t* dst,
+                        const uint8_t* src,
+                        size_t n)
+{
+    size_t i = 0;
+    for (; n - i >= 16; i += 16)
     {
-    case function_code::read_coil_status             : pos =  1; break;
-    case function_code::read_discrete_input_status   : pos =  1; break;
-    case function_code::read_holding_registers       : pos =  1; break;
-    case function_code::read_input_registers         : pos =  1; break;
-    case function_code::write_single_coil            : pos = -1; break;
-    case function_code::write_single_register        : pos = -1; break;
-    case function_code::write_multiple_coils         : pos = -1; break;
-    case function_code::write_multiple_registers     : pos = -1; break;
-    case function_code::read_write_multiple_registers: pos =  1; break;
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + 2 * i));
+        x = _mm256_or_si256(_mm256_slli_epi16(x, 8), _mm256_srli_epi16(x, 8));
+        _mm256_storeu_si256((__m256i*)(dst + 2 * i), x);
     }
+    return i;
+}
+#endif
 
-    const size_t byte_count = (buffer_len > pos) ? buffer[pos] : 0;
+void
+convert_registers (void* dst,
+                   const void* src,
+                   size_t n)
+{
+#ifdef MODBUS_REGISTERS_NATIVE
+    if (dst != src)
+        memcpy(dst, src, 2 * n);
+#else
+    uint8_t* d = (uint8_t*)dst;
+    const uint8_t* s = (const uint8_t*)src;
 
-    return pdu_len_rsp(func, byte_count);
+#ifdef MODBUS_SIMD_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2 && n >= 16)
+    {
+        size_t done = convert_registers_avx2(d, s, n);
+        d += 2 * done;
+        s += 2 * done;
+        n -= done;
+    }
+#endif
+#if defined(MODBUS_SIMD_SSE2)
+    for (; n >= 8; n -= 8, d += 16, s += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)s);
+        x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+        _mm_storeu_si128((__m128i*)d, x);
+    }
+#elif defined(MODBUS_SIMD_NEON)
+    for (; n >= 8; n -= 8, d += 16, s += 16)
+        vst1q_u8(d, vrev16q_u8(vld1q_u8(s)));
+#endif
+    for (; n; --n, d += 2, s += 2)
+    {
+        uint8_t hi = s[0];
+        d[0] = s[1];
+        d[1] = hi;
+    }
+#endif
+}
+
+uint16_t*
+registers_from_pdu (uint8_t* p,
+                    size_t n,
+                    bool convert)
+{
+    uint16_t* registers = aligned_registers(p);
+    if ((uint8_t*)registers != p)
+        memmove(registers, p, 2 * n);
+    if (convert)
+        convert_registers(registers, registers, n);
+    return registers;
+}
+
+void
+registers_to_pdu (uint16_t* registers,
+                  uint8_t* p,
+                  size_t n,
+                  bool convert)
+{
+    if (convert)
+        convert_registers(registers, registers, n);
+    if ((uint8_t*)registers != p)
+        memmove(p, registers, 2 * n);
 }
 
 /* ----------------------------------------------------------------------- */
 
-size_t
-pdu_len_req (function_code::function_code func,
-             size_t bc) // byte count
+// decodes n values of type T from W registers each, most significant first
+// unless the words are swapped
+template <typename T, size_t W>
+static void
+decode_batch (const uint16_t* registers,
+              size_t n,
+              bool word_swap,
+              bool byte_swap,
+              uint8_t* values)
+{
+    for (; n; --n, registers += W, values += sizeof(T))
+    {
+        T x = 0;
+        for (size_t i = 0; i < W; ++i)
+        {
+            uint16_t w = registers[word_swap ? W - 1 - i : i];
+            if (byte_swap)
+                w = (uint16_t)((w << 8) | (w >> 8));
+            x = (T)(((uint64_t)x << 16) | w);
+        }
+        memcpy(values, &x, sizeof(T));
+    }
+}
+
+// the reverse of decode_batch()
+template <typename T, size_t W>
+static void
+encode_batch (const uint8_t* values,
+              size_t n,
+              bool word_swap,
+              bool byte_swap,
+              uint16_t* registers)
+{
+    for (; n; --n, registers += W, values += sizeof(T))
+    {
+        T x;
+        memcpy(&x, values, sizeof(T));
+        for (size_t i = 0; i < W; ++i)
+        {
+            uint16_t w = (uint16_t)((uint64_t)x >> (16 * (W - 1 - i)));
+            if (byte_swap)
+                w = (uint16_t)((w << 8) | (w >> 8));
+            registers[word_swap ? W - 1 - i : i] = w;
+        }
+    }
+}
+
+bool
+decode_values (const uint16_t* registers,
+               size_t n,
+               data_type::data_type type,
+               word_order::word_order order,
+               void* values)
+{
+    bool word_swap = order == word_order::cdab || order == word_order::dcba;
+    bool byte_swap = order == word_order::badc || order == word_order::dcba;
+    uint8_t* p = (uint8_t*)values;
+
+    switch (type)
+    {
+    case data_type::uint16:
+    case data_type::int16:
+        decode_batch<uint16_t, 1>(registers, n, word_swap, byte_swap, p);
+        return true;
+    case data_type::uint32:
+    case data_type::int32:
+    case data_type::float32:
+        decode_batch<uint32_t, 2>(registers, n, word_swap, byte_swap, p);
+        return true;
+    case data_type::float64:
+        if (sizeof(double) != sizeof(uint64_t))
+            return false;
+        // fall through
+    case data_type::uint64:
+    case data_type::int64:
+        decode_batch<uint64_t, 4>(registers, n, word_swap, byte_swap, p);
+        return true;
+    }
+    return false;
+}
+
+bool
+encode_values (const void* values,
+               size_t n,
+               data_type::data_type type,
+               word_order::word_order order,
+               uint16_t* registers)
+{
+    bool word_swap = order == word_order::cdab || order == word_order::dcba;
+    bool byte_swap = order == word_order::badc || order == word_order::dcba;
+    const uint8_t* p = (const uint8_t*)values;
+
+    switch (type)
+    {
+    case data_type::uint16:
+    case data_type::int16:
+        encode_batch<uint16_t, 1>(p, n, word_swap, byte_swap, registers);
+        return true;
+    case data_type::uint32:
+    case data_type::int32:
+    case data_type::float32:
+        encode_batch<uint32_t, 2>(p, n, word_swap, byte_swap, registers);
+        return true;
+    case data_type::float64:
+        if (sizeof(double) != sizeof(uint64_t))
+            return false;
+        // fall through
+    case data_type::uint64:
+    case data_type::int64:
+        encode_batch<uint64_t, 4>(p, n, word_swap, byte_swap, registers);
+        return true;
+    }
+    return false;
+}
+
+/* ----------------------------------------------------------------------- */
+
+#ifdef MODBUS_PACKED_BITS_WORDS
+// each byte of the word, in memory order, gets one bit of b (0 or 1)
+static inline uint64_t
+spread_bits (uint8_t b)
+{
+    uint64_t x = (b * 0x0101010101010101ull) & 0x8040201008040201ull;
+    return ((x + 0x7f7f7f7f7f7f7f7full) >> 7) & 0x0101010101010101ull;
+}
+
+// bit i of the result is set if byte i of the word, in memory order, is not 0
+static inline uint8_t
+gather_bits (uint64_t x)
+{
+    x = ((((x & 0x7f7f7f7f7f7f7f7full) + 0x7f7f7f7f7f7f7f7full) | x) & 0x8080808080808080ull) >> 7;
+    return (uint8_t)((x * 0x0102040810204080ull) >> 56);
+}
+#endif
+
+void
+unpack_bits (const uint8_t* bits,
+             size_t n,
+             uint8_t* values)
+{
+#ifdef MODBUS_PACKED_BITS_WORDS
+    for (; n >= 8; n -= 8, values += 8)
+    {
+        uint64_t x = spread_bits(*bits++);
+        memcpy(values, &x, 8);
+    }
+#endif
+    for (size_t i = 0; i < n; ++i)
+        values[i] = (bits[i / 8] >> (i % 8)) & 1;
+}
+
+void
+unpack_bits (const uint8_t* bits,
+             size_t n,
+             bool* values)
 {
-    switch (func)
+    if (sizeof(bool) == 1)
     {
-    case function_code::read_coil_status             :         return pdu_len_req_read_coil_status             (  ); break;
-    case function_code::read_discrete_input_status   :         return pdu_len_req_read_discrete_input_status   (  ); break;
-    case function_code::read_holding_registers       :         return pdu_len_req_read_holding_registers       (  ); break;
-    case function_code::read_input_registers         :         return pdu_len_req_read_input_registers         (  ); break;
-    case function_code::write_single_coil            :         return pdu_len_req_write_single_coil            (  ); break;
-    case function_code::write_single_register        :         return pdu_len_req_write_single_register        (  ); break;
-    case function_code::write_multiple_coils         : if (bc) return pdu_len_req_write_multiple_coils         (bc); break;
-    case function_code::write_multiple_registers     : if (bc) return pdu_len_req_write_multiple_registers     (bc); break;
-    case function_code::read_write_multiple_registers: if (bc) return pdu_len_req_read_write_multiple_registers(bc); break;
+        // a bool holds 0 or 1 in a single byte
+        unpack_bits(bits, n, (uint8_t*)values);
+        return;
     }
+    for (size_t i = 0; i < n; ++i)
+        values[i] = ((bits[i / 8] >> (i % 8)) & 1) != 0;
+}
+
+void
+pack_bits (const uint8_t* values,
+           size_t n,
+           uint8_t* bits)
+{
+#ifdef MODBUS_PACKED_BITS_WORDS
+    for (; n >= 8; n -= 8, values += 8)
+    {
+        uint64_t x;
+        memcpy(&x, values, 8);
+        *bits++ = gather_bits(x);
+    }
+#endif
+    if (!n)
+        return;
+
+    // the unused bits of the last byte are 0
+    uint8_t last = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (values[i])
+            last |= (uint8_t)(1 << i % 8);
+        if (i % 8 == 7)
+        {
+            *bits++ = last;
+            last = 0;
+        }
+    }
+    if (n % 8)
+        *bits = last;
+}
+
+void
+pack_bits (const bool* values,
+           size_t n,
+           uint8_t* bits)
+{
+    if (sizeof(bool) == 1)
+    {
+        pack_bits((const uint8_t*)values, n, bits);
+        return;
+    }
+
+    memset(bits, 0, packed_bits_len(n));
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (values[i])
+            bits[i / 8] |= (uint8_t)(1 << i % 8);
+    }
+}
+
+
+void
+extract_bits (const uint8_t* bits,
+              size_t offset,
+              size_t n,
+              uint8_t* result)
+{
+    bits += offset / 8;
+    unsigned int shift = offset % 8;
+
+#ifdef MODBUS_PACKED_BITS_WORDS
+    // 64 bits at a time; the next source byte supplies the top bits
+    for (; n >= 64; n -= 64, bits += 8, result += 8)
+    {
+        uint64_t x;
+        memcpy(&x, bits, 8);
+        if (shift)
+            x = (x >> shift) | ((uint64_t)bits[8] << (64 - shift));
+        memcpy(result, &x, 8);
+    }
+#endif
+    for (; n; bits++, result++)
+    {
+        unsigned int len = n < 8 ? (unsigned int)n : 8;
+        unsigned int x = *bits >> shift;
+        if (shift + len > 8)
+            x |= bits[1] << (8 - shift);
+        *result = (uint8_t)(x & ((1u << len) - 1));
+        n -= len;
+    }
+}
+
+void
+insert_bits (uint8_t* bits,
+             size_t offset,
+             size_t n,
+             const uint8_t* values)
+{
+    bits += offset / 8;
+    unsigned int shift = offset % 8;
 
+#ifdef MODBUS_PACKED_BITS_WORDS
+    // 64 bits at a time; the bits below the offset are kept, and the top
+    // bits spill into the next byte
+    for (; n >= 64; n -= 64, bits += 8, values += 8)
+    {
+        uint64_t x, v;
+        memcpy(&x, bits, 8);
+        memcpy(&v, values, 8);
+        x = (x & ((1ull << shift) - 1)) | (v << shift);
+        memcpy(bits, &x, 8);
+        if (shift)
+            bits[8] = (uint8_t)((bits[8] & (0xff << shift)) | (v >> (64 - shift)));
+    }
+#endif
+    for (; n; bits++, values++)
+    {
+        unsigned int len = n < 8 ? (unsigned int)n : 8;
+        unsigned int mask = ((1u << len) - 1) << shift;
+        unsigned int x = (*values << shift) & mask;
+        bits[0] = (uint8_t)((bits[0] & ~mask) | x);
+        if (mask >> 8)
+            bits[1] = (uint8_t)((bits[1] & ~(mask >> 8)) | (x >> 8));
+        n -= len;
+    }
+}
+
+
+/* ----------------------------------------------------------------------- */
+
+// returns the value of a hex digit, or -1 if it is not one
+static inline int
+hex_value (uint8_t ch)
+{
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    ch |= 0x20;
+    if (ch >= 'a' && ch <= 'f')
+        return ch - 'a' + 10;
     return -1;
 }
 
+#if defined(MODBUS_SIMD_SSE2)
+// converts 16 characters to their values, setting valid to all ones for each hex digit
+static inline __m128i
+hex_values_sse2 (__m128i ch,
+                 __m128i* valid)
+{
+    __m128i lower = _mm_or_si128(ch, _mm_set1_epi8(0x20));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(ch, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(ch, _mm_set1_epi8('9' + 1)));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    *valid = _mm_or_si128(digit, alpha);
+    return _mm_add_epi8(_mm_and_si128(ch, _mm_set1_epi8(0x0f)), _mm_and_si128(alpha, _mm_set1_epi8(9)));
+}
+
+// combines the high and low nibbles of 8 bytes into the low byte of each 16 bit lane
+static inline __m128i
+hex_bytes_sse2 (__m128i values)
+{
+    __m128i x = _mm_or_si128(_mm_slli_epi16(values, 4), _mm_srli_epi16(values, 8));
+    return _mm_and_si128(x, _mm_set1_epi16(0xff));
+}
+
+// converts the values 0 to 15 to upper case hex digits
+static inline __m128i
+hex_digits_sse2 (__m128i values)
+{
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(values, _mm_set1_epi8(9)), _mm_set1_epi8('A' - '0' - 10));
+    return _mm_add_epi8(values, _mm_add_epi8(alpha, _mm_set1_epi8('0')));
+}
+#endif
+
+#ifdef MODBUS_SIMD_AVX2
+static inline MODBUS_SIMD_AVX2 __m256i
+hex_values_avx2 (__m256i ch,
+                 __m256i* valid)
+{
+    __m256i lower = _mm256_or_si256(ch, _mm256_set1_epi8(0x20));
+    __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(ch, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), ch));
+    __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+    *valid = _mm256_or_si256(digit, alpha);
+    return _mm256_add_epi8(_mm256_and_si256(ch, _mm256_set1_epi8(0x0f)), _mm256_and_si256(alpha, _mm256_set1_epi8(9)));
+}
+
+static inline MODBUS_SIMD_AVX2 __m256i
+hex_bytes_avx2 (__m256i values)
+{
+    __m256i x = _mm256_or_si256(_mm256_slli_epi16(values, 4), _mm256_srli_epi16(values, 8));
+    return _mm256_and_si256(x, _mm256_set1_epi16(0xff));
+}
+
+static inline MODBUS_SIMD_AVX2 __m256i
+hex_digits_avx2 (__m256i values)
+{
+    __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(values, _mm256_set1_epi8(9)), _mm256_set1_epi8('A' - '0' - 10));
+    return _mm256_add_epi8(values, _mm256_add_epi8(alpha, _mm256_set1_epi8('0')));
+}
+
+// adds up the four 64 bit sums of _mm256_sad_epu8()
+static inline MODBUS_SIMD_AVX2 unsigned int
+hex_sum_avx2 (__m256i sums)
+{
+    __m128i x = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+    return (unsigned int)_mm_cvtsi128_si32(x) + (unsigned int)_mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+}
+
+// decodes 32 bytes at a time, returning the number decoded
+static MODBUS_SIMD_AVX2 size_t
+decode_hex_avx2 (const uint8_t* hex,
+                 size_t n,
+                 uint8_t* bytes,
+                 unsigned int* sum)
+{
+    __m256i sums = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; n - i >= 32; i += 32)
+    {
+        __m256i va, vb;
+        __m256i a = hex_values_avx2(_mm256_loadu_si256((const __m256i*)(hex + 2 * i)), &va);
+        __m256i b = hex_values_avx2(_mm256_loadu_si256((const __m256i*)(hex + 2 * i + 32)), &vb);
+        if (_mm256_movemask_epi8(_mm256_and_si256(va, vb)) != -1)
+            break;
+
+        // the pack works within each 128 bit lane, so put the quarters back in order
+        __m256i x = _mm256_packus_epi16(hex_bytes_avx2(a), hex_bytes_avx2(b));
+        x = _mm256_permute4x64_epi64(x, 0xd8);
+        _mm256_storeu_si256((__m256i*)(bytes + i), x);
+        sums = _mm256_add_epi64(sums, _mm256_sad_epu8(x, _mm256_setzero_si256()));
+    }
+    *sum += hex_sum_avx2(sums);
+    return i;
+}
+
+// encodes 32 bytes at a time, returning the number encoded
+static MODBUS_SIMD_AVX2 size_t
+encode_hex_avx2 (const uint8_t* bytes,
+                 size_t n,
+                 uint8_t* hex,
+                 unsigned int* sum)
+{
+    __m256i sums = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; n - i >= 32; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(bytes + i));
+        __m256i hi = hex_digits_avx2(_mm256_and_si256(_mm256_srli_epi16(x, 4), _mm256_set1_epi8(0x0f)));
+        __m256i lo = hex_digits_avx2(_mm256_and_si256(x, _mm256_set1_epi8(0x0f)));
+
+        // the unpack works within each 128 bit lane, so put the halves back in order
+        __m256i a = _mm256_unpacklo_epi8(hi, lo);
+        __m256i b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i*)(hex + 2 * i), _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i*)(hex + 2 * i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+        sums = _mm256_add_epi64(sums, _mm256_sad_epu8(x, _mm256_setzero_si256()));
+    }
+    *sum += hex_sum_avx2(sums);
+    return i;
+}
+#endif
+
+#ifdef MODBUS_SIMD_NEON
+static inline uint8x16_t
+hex_values_neon (uint8x16_t ch,
+                 uint8x16_t* valid)
+{
+    uint8x16_t lower = vorrq_u8(ch, vdupq_n_u8(0x20));
+    uint8x16_t digit = vandq_u8(vcgeq_u8(ch, vdupq_n_u8('0')), vcleq_u8(ch, vdupq_n_u8('9')));
+    uint8x16_t alpha = vandq_u8(vcgeq_u8(lower, vdupq_n_u8('a')), vcleq_u8(lower, vdupq_n_u8('f')));
+    *valid = vorrq_u8(digit, alpha);
+    return vaddq_u8(vandq_u8(ch, vdupq_n_u8(0x0f)), vandq_u8(alpha, vdupq_n_u8(9)));
+}
+
+static inline uint8x16_t
+hex_digits_neon (uint8x16_t values)
+{
+    uint8x16_t alpha = vandq_u8(vcgtq_u8(values, vdupq_n_u8(9)), vdupq_n_u8('A' - '0' - 10));
+    return vaddq_u8(values, vaddq_u8(alpha, vdupq_n_u8('0')));
+}
+
+// adds up the 16 bytes in 64 bit lanes
+static inline uint64x2_t
+hex_sum_neon (uint8x16_t x)
+{
+    return vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(x)));
+}
+#endif
+
 size_t
-pdu_len_rsp (function_code::function_code func,
-             size_t bc) // byte count
+decode_hex (const uint8_t* hex,
+            size_t n,
+            uint8_t* bytes,
+            uint8_t* sum)
+{
+    unsigned int total = 0;
+    size_t i = 0;
+
+#ifdef MODBUS_SIMD_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2 && n >= 32)
+        i = decode_hex_avx2(hex, n, bytes, &total);
+#endif
+#if defined(MODBUS_SIMD_SSE2)
+    __m128i sums = _mm_setzero_si128();
+    for (; n - i >= 16; i += 16)
+    {
+        __m128i va, vb;
+        __m128i a = hex_values_sse2(_mm_loadu_si128((const __m128i*)(hex + 2 * i)), &va);
+        __m128i b = hex_values_sse2(_mm_loadu_si128((const __m128i*)(hex + 2 * i + 16)), &vb);
+        if (_mm_movemask_epi8(_mm_and_si128(va, vb)) != 0xffff)
+            break;
+        __m128i x = _mm_packus_epi16(hex_bytes_sse2(a), hex_bytes_sse2(b));
+        _mm_storeu_si128((__m128i*)(bytes + i), x);
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(x, _mm_setzero_si128()));
+    }
+    total += (unsigned int)_mm_cvtsi128_si32(sums) + (unsigned int)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+#elif defined(MODBUS_SIMD_NEON)
+    uint64x2_t sums = vdupq_n_u64(0);
+    for (; n - i >= 16; i += 16)
+    {
+        // the high and low nibbles are loaded into separate vectors
+        uint8x16x2_t ch = vld2q_u8(hex + 2 * i);
+        uint8x16_t va, vb;
+        uint8x16_t a = hex_values_neon(ch.val[0], &va);
+        uint8x16_t b = hex_values_neon(ch.val[1], &vb);
+        uint64x2_t valid = vreinterpretq_u64_u8(vandq_u8(va, vb));
+        if (~(vgetq_lane_u64(valid, 0) & vgetq_lane_u64(valid, 1)))
+            break;
+        uint8x16_t x = vorrq_u8(vshlq_n_u8(a, 4), b);
+        vst1q_u8(bytes + i, x);
+        sums = vaddq_u64(sums, hex_sum_neon(x));
+    }
+    total += (unsigned int)(vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1));
+#endif
+    for (; i < n; ++i)
+    {
+        int hi = hex_value(hex[2 * i]);
+        int lo = hex_value(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            break;
+        bytes[i] = (uint8_t)(hi << 4 | lo);
+        total += bytes[i];
+    }
+
+    if (sum)
+        *sum = (uint8_t)(*sum + total);
+    return i;
+}
+
+void
+encode_hex (const uint8_t* bytes,
+            size_t n,
+            uint8_t* hex,
+            uint8_t* sum)
 {
-    switch (func)
+    static const char digits[] = "0123456789ABCDEF";
+    unsigned int total = 0;
+    size_t i = 0;
+
+#ifdef MODBUS_SIMD_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2 && n >= 32)
+        i = encode_hex_avx2(bytes, n, hex, &total);
+#endif
+#if defined(MODBUS_SIMD_SSE2)
+    __m128i sums = _mm_setzero_si128();
+    for (; n - i >= 16; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)(bytes + i));
+        __m128i hi = hex_digits_sse2(_mm_and_si128(_mm_srli_epi16(x, 4), _mm_set1_epi8(0x0f)));
+        __m128i lo = hex_digits_sse2(_mm_and_si128(x, _mm_set1_epi8(0x0f)));
+        _mm_storeu_si128((__m128i*)(hex + 2 * i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*)(hex + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(x, _mm_setzero_si128()));
+    }
+    total += (unsigned int)_mm_cvtsi128_si32(sums) + (unsigned int)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+#elif defined(MODBUS_SIMD_NEON)
+    uint64x2_t sums = vdupq_n_u64(0);
+    for (; n - i >= 16; i += 16)
     {
-    case function_code::read_coil_status             : if (bc) return pdu_len_rsp_read_coil_status             (bc); break;
-    case function_code::read_discrete_input_status   : if (bc) return pdu_len_rsp_read_discrete_input_status   (bc); break;
-    case function_code::read_holding_registers       : if (bc) return pdu_len_rsp_read_holding_registers       (bc); break;
-    case function_code::read_input_registers         : if (bc) return pdu_len_rsp_read_input_registers         (bc); break;
-    case function_code::write_single_coil            :         return pdu_len_rsp_write_single_coil            (  ); break;
-    case function_code::write_single_register        :         return pdu_len_rsp_write_single_register        (  ); break;
-    case function_code::write_multiple_coils         :         return pdu_len_rsp_write_multiple_coils         (  ); break;
-    case function_code::write_multiple_registers     :         return pdu_len_rsp_write_multiple_registers     (  ); break;
-    case function_code::read_write_multiple_registers: if (bc) return pdu_len_rsp_read_write_multiple_registers(bc); break;
+        // the high and low nibbles are interleaved by the store
+        uint8x16_t x = vld1q_u8(bytes + i);
+        uint8x16x2_t ch;
+        ch.val[0] = hex_digits_neon(vshrq_n_u8(x, 4));
+        ch.val[1] = hex_digits_neon(vandq_u8(x, vdupq_n_u8(0x0f)));
+        vst2q_u8(hex + 2 * i, ch);
+        sums = vaddq_u64(sums, hex_sum_neon(x));
+    }
+    total += (unsigned int)(vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1));
+#endif
+    for (; i < n; ++i)
+    {
+        hex[2 * i] = digits[bytes[i] >> 4];
+        hex[2 * i + 1] = digits[bytes[i] & 0x0f];
+        total += bytes[i];
     }
 
-    return -1;
+    if (sum)
+        *sum = (uint8_t)(*sum + total);
 }
 
 }
@@ -21,7 +21,7 @@ extern size_t pdu_len (uint8_t station_address, const uint8_t* buffer, size_t bu
 extern size_t pdu_len_req (const uint8_t* buffer, size_t buffer_len);
 extern size_t pdu_len_req (function_code::function_code func, size_t byte_count = 0);
 
-inline size_t pdu_len_req_read_coil_status ()
+constexpr size_t pdu_len_req_read_coil_status ()
 {
     return PDU_LEN_FUNCTION
          + PDU_LEN_ADDRESS
@@ -29,22 +29,22 @@ inline size_t pdu_len_req_read_coil_status ()
          + PDU_LEN_CRC;
 }
 
-inline size_t pdu_len_req_read_discrete_input_status ()
+constexpr size_t pdu_len_req_read_discrete_input_status ()
 { return pdu_len_req_read_coil_status(); }
 
-inline size_t pdu_len_req_read_holding_registers ()
+constexpr size_t pdu_len_req_read_holding_registers ()
 { return pdu_len_req_read_coil_status(); }
 
-inline size_t pdu_len_req_read_input_registers ()
+constexpr size_t pdu_len_req_read_input_registers ()
 { return pdu_len_req_read_coil_status(); }
 
-inline size_t pdu_len_req_write_single_coil ()
+constexpr size_t pdu_len_req_write_single_coil ()
 { return pdu_len_req_read_coil_status(); }
 
-inline size_t pdu_len_req_write_single_register ()
+constexpr size_t pdu_len_req_write_single_register ()
 { return pdu_len_req_read_coil_status(); }
 
-inline size_t pdu_len_req_write_multiple_coils (int byte_count)
+constexpr size_t pdu_len_req_write_multiple_coils (int byte_count)
 {
     return PDU_LEN_FUNCTION
          + PDU_LEN_ADDRESS
@@ -54,10 +54,19 @@ inline size_t pdu_len_req_write_multiple_coils (int byte_count)
          + PDU_LEN_CRC;
 }
 
-inline size_t pdu_len_req_write_multiple_registers (int byte_count)
+constexpr size_t pdu_len_req_write_multiple_registers (int byte_count)
 { return pdu_len_req_write_multiple_coils(byte_count); }
 
-inline size_t pdu_len_req_read_write_multiple_registers (int byte_count)
+constexpr size_t pdu_len_req_mask_write_register ()
+{
+    return PDU_LEN_FUNCTION
+         + PDU_LEN_ADDRESS
+         + 2 // AND mask
+         + 2 // OR mask
+         + PDU_LEN_CRC;
+}
+
+constexpr size_t pdu_len_req_read_write_multiple_registers (int byte_count)
 {
     return PDU_LEN_FUNCTION
          + PDU_LEN_ADDRESS
@@ -74,7 +83,7 @@ inline size_t pdu_len_req_read_write_multiple_registers (int byte_count)
 extern size_t pdu_len_rsp (const uint8_t* buffer, size_t buffer_len);
 extern size_t pdu_len_rsp (function_code::function_code func, size_t byte_count = 0);
 
-inline size_t pdu_len_rsp_read_coil_status (int byte_count)
+constexpr size_t pdu_len_rsp_read_coil_status (int byte_count)
 {
     return PDU_LEN_FUNCTION
          + PDU_LEN_BYTE_COUNT
@@ -82,16 +91,16 @@ inline size_t pdu_len_rsp_read_coil_status (int byte_count)
          + PDU_LEN_CRC;
 }
 
-inline size_t pdu_len_rsp_read_discrete_input_status (int byte_count)
+constexpr size_t pdu_len_rsp_read_discrete_input_status (int byte_count)
 { return pdu_len_rsp_read_coil_status(byte_count); }
 
-inline size_t pdu_len_rsp_read_holding_registers (int byte_count)
+constexpr size_t pdu_len_rsp_read_holding_registers (int byte_count)
 { return pdu_len_rsp_read_coil_status(byte_count); }
 
-inline size_t pdu_len_rsp_read_input_registers (int byte_count)
+constexpr size_t pdu_len_rsp_read_input_registers (int byte_count)
 { return pdu_len_rsp_read_coil_status(byte_count); }
 
-inline size_t pdu_len_rsp_write_single_coil ()
+constexpr size_t pdu_len_rsp_write_single_coil ()
 {
     return PDU_LEN_FUNCTION
          + PDU_LEN_ADDRESS
@@ -99,18 +108,107 @@ inline size_t pdu_len_rsp_write_single_coil ()
          + PDU_LEN_CRC;
 }
 
-inline size_t pdu_len_rsp_write_single_register ()
+constexpr size_t pdu_len_rsp_write_single_register ()
 { return pdu_len_rsp_write_single_coil(); }
 
-inline size_t pdu_len_rsp_write_multiple_coils ()
+constexpr size_t pdu_len_rsp_write_multiple_coils ()
 { return pdu_len_rsp_write_single_coil(); }
 
-inline size_t pdu_len_rsp_write_multiple_registers ()
+constexpr size_t pdu_len_rsp_write_multiple_registers ()
 { return pdu_len_rsp_write_single_coil(); }
 
-inline size_t pdu_len_rsp_read_write_multiple_registers (int byte_count)
+constexpr size_t pdu_len_rsp_mask_write_register ()
+{ return pdu_len_req_mask_write_register(); }
+
+constexpr size_t pdu_len_rsp_read_write_multiple_registers (int byte_count)
 { return pdu_len_rsp_read_coil_status(byte_count); }
 
+/* --- register byte order ---------------------------------------------- */
+
+// Registers are big-endian in the PDU.  Copies n registers from src to dst,
+// converting them between the PDU and the host byte order.  Neither buffer
+// needs to be aligned, and dst may be the same as src to convert in place,
+// but the buffers must not otherwise overlap.
+
+extern void convert_registers (void* dst, const void* src, size_t n);
+
+// The registers of a PDU are not always at an even address; in a TCP frame
+// the PDU follows the 7 byte MBAP header.  aligned_registers() returns the
+// aligned location for the registers at p, which is either p itself or the
+// byte before it, which must be free to use.  registers_from_pdu() moves
+// the n registers at p there and converts them to the host byte order if
+// convert is true, and registers_to_pdu() does the reverse.
+
+inline uint16_t*
+aligned_registers (uint8_t* p)
+{ return (uint16_t*)(p - ((uintptr_t)p & 1)); }
+
+extern uint16_t* registers_from_pdu (uint8_t* p, size_t n, bool convert = true);
+extern void registers_to_pdu (uint16_t* registers, uint8_t* p, size_t n, bool convert = true);
+
+/* --- typed values ----------------------------------------------------- */
+
+inline size_t
+data_type_registers (data_type::data_type type)
+{
+    switch (type)
+    {
+    case data_type::uint16:
+    case data_type::int16:
+        return 1;
+    case data_type::uint32:
+    case data_type::int32:
+    case data_type::float32:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+// Converts n consecutive values of the given type between an array of host
+// order registers and an array of values, using the word order of the
+// device.  The array of values needs no particular alignment.  These return
+// false if the type is not supported by the target (double precision values
+// on targets where a double has only 32 bits).
+
+extern bool decode_values (const uint16_t* registers, size_t n, data_type::data_type type, word_order::word_order order, void* values);
+extern bool encode_values (const void* values, size_t n, data_type::data_type type, word_order::word_order order, uint16_t* registers);
+
+/* --- packed bits ------------------------------------------------------- */
+
+// Coils and discrete inputs are packed 8 to a byte, with the first one in
+// the least significant bit of the first byte, as in the PDU.
+
+extern void unpack_bits (const uint8_t* bits, size_t n, uint8_t* values);
+extern void unpack_bits (const uint8_t* bits, size_t n, bool* values);
+extern void pack_bits (const uint8_t* values, size_t n, uint8_t* bits);
+extern void pack_bits (const bool* values, size_t n, uint8_t* bits);
+
+// Copies n bits starting at bit offset of the bit array into result,
+// starting at bit 0; the unused bits of the last byte are 0.
+extern void extract_bits (const uint8_t* bits, size_t offset, size_t n, uint8_t* result);
+
+// Copies n bits from values, starting at bit 0, into the bit array starting
+// at bit offset; the other bits of the array are left unchanged.
+extern void insert_bits (uint8_t* bits, size_t offset, size_t n, const uint8_t* values);
+
+inline size_t packed_bits_len (size_t n)
+{ return (n + 7) / 8; }
+
+/* --- ASCII hex --------------------------------------------------------- */
+
+// In the ASCII framing, each byte is sent as two hex digits, high nibble
+// first, and the LRC is the negated 8 bit sum of the bytes.
+//
+// decode_hex() converts up to n pairs of hex digits into bytes, stopping at
+// the first pair that contains anything else, and returns the number of
+// bytes converted; either case of hex digit is accepted.  encode_hex()
+// converts n bytes into 2 * n upper case hex digits.  Both add the bytes
+// to *sum unless sum is NULL.
+
+extern size_t decode_hex (const uint8_t* hex, size_t n, uint8_t* bytes, uint8_t* sum);
+extern void encode_hex (const uint8_t* bytes, size_t n, uint8_t* hex, uint8_t* sum);
+
 }
 
 #endif
@@ -1,6 +1,8 @@
 #include "stdafx.h"
 #include "../../../../ModbusRTU.h"
 #include "../../../../ModbusASCII.h"
+#include "../../../../ModbusCRC16.h"
+#include "../../../../ModbusTCP.h"
 #include <stdexcept>
 #include <vector>
 #include <tuple>
@@ -30,6 +32,8 @@ namespace UnitTests
             ,   m_tx_status()
             ,   m_rx_on_count()
             ,   m_tx_on_count()
+            ,   m_writev_count()
+            ,   max_write()
         {
         }
         virtual int read(uint8_t* buffer, size_t buffer_size)
@@ -59,11 +63,22 @@ namespace UnitTests
         {
             if (!len || ticks() == m_last_write)
                 return 0;
+            if (max_write && len > max_write)
+                len = max_write;
             m_write.push_back(std::tr1::make_tuple(m_time, std::string(buffer, buffer + len)));
             m_last_write = ticks();
             write_data.insert(write_data.end(), buffer, buffer + len);
             return len;
         }
+        virtual int writev(const segment* segments, size_t count)
+        {
+            // gather the buffers into a single write, like a driver with writev() support
+            std::string data;
+            for (size_t i = 0; i < count; ++i)
+                data.append(segments[i].buffer, segments[i].buffer + segments[i].len);
+            m_writev_count++;
+            return write((uint8_t*)&data[0], data.size());
+        }
         virtual void txEnable(bool state)
         {
         }
@@ -92,7 +107,8 @@ namespace UnitTests
         void written(std::vector<std::tr1::tuple<system_tick_t /*start*/, std::string /*data*/> >& result) const { result = m_write; }
         std::string write_data;
         bool m_rx_status, m_tx_status;
-        int m_rx_on_count, m_tx_on_count;
+        int m_rx_on_count, m_tx_on_count, m_writev_count;
+        size_t max_write; // maximum number of characters accepted by each write, or 0 for no limit
     private:
         system_tick_t m_time, m_last_write;
         size_t m_pos, m_col;
@@ -154,6 +170,155 @@ namespace UnitTests
             Assert::AreEqual(0, stream.m_tx_on_count);
         };
 
+        [TestMethod]
+        void TestReceiveRTUEarlyCompletion()
+        {
+            std::vector<std::tr1::tuple<system_tick_t /*start*/, std::string /*data*/> > items;
+
+            // incoming request at 5ms
+            uint8_t frame1[] = { 1, 3, 0x00, 0x00, 0x00, 0x0A, 0xC5, 0xCD };
+            items.push_back(std::tr1::make_tuple(5, std::string(frame1, frame1 + _countof(frame1))));
+
+            // parse the frames
+            CDummyStream stream(items);
+            uint8_t buffer[MODBUS_DATA_BUFFER_SIZE];
+            CModbusRTU rtu(&stream, &stream, buffer, _countof(buffer));
+            rtu.setup(9600);
+            rtu.set_station_address(1);
+
+            while (stream.ticks() < 6)
+            {
+                rtu.poll();
+                stream.increment(1);
+            }
+
+            // the frame should be ready without waiting for the T3.5 delay
+            Assert::AreEqual(true, rtu.frame_ready());
+            Assert::AreEqual((byte)1, rtu.frame_address());
+            Assert::AreEqual(5u, rtu.buffer_len());
+        };
+
+        [TestMethod]
+        void TestReceiveRTUEarlyCompletionException()
+        {
+            std::vector<std::tr1::tuple<system_tick_t /*start*/, std::string /*data*/> > items;
+
+            // incoming exception response at 5ms
+            uint8_t frame1[] = { 0x01, 0x83, 0x02, 0xC0, 0xF1 };
+            items.push_back(std::tr1::make_tuple(5, std::string(frame1, frame1 + _countof(frame1))));
+
+            // parse the frames as a master, which expects responses
+            CDummyStream stream(items);
+            uint8_t buffer[MODBUS_DATA_BUFFER_SIZE];
+            CModbusRTU rtu(&stream, &stream, buffer, _countof(buffer));
+            rtu.setup(9600);
+
+            while (stream.ticks() < 6)
+            {
+                rtu.poll();
+                stream.increment(1);
+            }
+
+            // the frame should be ready without waiting for the T3.5 delay
+            Assert::AreEqual(true, rtu.frame_ready());
+            Assert::AreEqual((byte)1, rtu.frame_address());
+            Assert::AreEqual(2u, rtu.buffer_len());
+        };
+
+        [TestMethod]
+        void TestReceiveRTUEarlyCompletionMaskWrite()
+        {
+            std::vector<std::tr1::tuple<system_tick_t /*start*/, std::string /*data*/> > items;
+
+            // incoming mask write register request at 5ms
+            uint8_t frame1[] = { 0x01, 0x16, 0x00, 0x04, 0x00, 0xF2, 0x00, 0x25, 0x67, 0xEE };
+            items.push_back(std::tr1::make_tuple(5, std::string(frame1, frame1 + _countof(frame1))));
+
+            // parse the frames
+            CDummyStream stream(items);
+            uint8_t buffer[MODBUS_DATA_BUFFER_SIZE];
+            CModbusRTU rtu(&stream, &stream, buffer, _countof(buffer));
+            rtu.setup(9600);
+            rtu.set_station_address(1);
+
+            while (stream.ticks() < 6)
+            {
+                rtu.poll();
+                stream.increment(1);
+            }
+
+            // the frame should be ready without waiting for the T3.5 delay
+            Assert::AreEqual(true, rtu.frame_ready());
+            Assert::AreEqual((byte)1, rtu.frame_address());
+            Assert::AreEqual(7u, rtu.buffer_len());
+        };
+
+        [TestMethod]
+        void TestReceiveRTUEarlyCompletionReadWrite()
+        {
+            std::vector<std::tr1::tuple<system_tick_t /*start*/, std::string /*data*/> > items;
+
+            // incoming read/write multiple registers request at 5ms
+            uint8_t frame1[] = { 0x01, 0x17, 0x00, 0x03, 0x00, 0x06, 0x00, 0x0E, 0x00, 0x03, 0x06, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF, 0x46, 0x91 };
+            items.push_back(std::tr1::make_tuple(5, std::string(frame1, frame1 + _countof(frame1))));
+
+            // parse the frames
+            CDummyStream stream(items);
+            uint8_t buffer[MODBUS_DATA_BUFFER_SIZE];
+            CModbusRTU rtu(&stream, &stream, buffer, _countof(buffer));
+            rtu.setup(9600);
+            rtu.set_station_address(1);
+
+            while (stream.ticks() < 6)
+            {
+                rtu.poll();
+                stream.increment(1);
+            }
+
+            // the frame should be ready without waiting for the T3.5 delay
+            Assert::AreEqual(true, rtu.frame_ready());
+            Assert::AreEqual((byte)1, rtu.frame_address());
+            Assert::AreEqual(16u, rtu.buffer_len());
+        };
+
+        [TestMethod]
+        void TestReceiveRTUStrictFraming()
+        {
+            std::vector<std::tr1::tuple<system_tick_t /*start*/, std::string /*data*/> > items;
+
+            // incoming request at 5ms
+            uint8_t frame1[] = { 1, 3, 0x00, 0x00, 0x00, 0x0A, 0xC5, 0xCD };
+            items.push_back(std::tr1::make_tuple(5, std::string(frame1, frame1 + _countof(frame1))));
+
+            // parse the frames
+            CDummyStream stream(items);
+            uint8_t buffer[MODBUS_DATA_BUFFER_SIZE];
+            CModbusRTU rtu(&stream, &stream, buffer, _countof(buffer));
+            rtu.setup(9600);
+            rtu.set_station_address(1);
+            rtu.set_strict_framing(true);
+
+            while (stream.ticks() < 6)
+            {
+                rtu.poll();
+                stream.increment(1);
+            }
+
+            // the frame must not be ready until the T3.5 delay has elapsed
+            Assert::AreEqual(false, rtu.frame_ready());
+
+            while (stream.ticks() < 10)
+            {
+                rtu.poll();
+                stream.increment(1);
+            }
+
+            // check the result
+            Assert::AreEqual(true, rtu.frame_ready());
+            Assert::AreEqual((byte)1, rtu.frame_address());
+            Assert::AreEqual(5u, rtu.buffer_len());
+        };
+
         [TestMethod]
         void TestReceiveASCIIFrame()
         {
@@ -186,6 +351,36 @@ namespace UnitTests
             Assert::AreEqual(0, stream.m_tx_on_count);
         };
 
+        [TestMethod]
+        void TestReceiveASCIIChecksum()
+        {
+            std::vector<std::tr1::tuple<system_tick_t /*start*/, std::string /*data*/> > items;
+
+            // incoming datagram with a bad LRC at 2ms, followed by a good one at 4ms
+            uint8_t frame1[] = ":1103006B00037F\r\n";
+            items.push_back(std::tr1::make_tuple(2, std::string(frame1, frame1 + _countof(frame1) - 1)));
+            uint8_t frame2[] = ":1203006B00037D\r\n";
+            items.push_back(std::tr1::make_tuple(4, std::string(frame2, frame2 + _countof(frame2) - 1)));
+
+            // parse the frames
+            CDummyStream stream(items);
+            uint8_t buffer[MODBUS_DATA_BUFFER_SIZE];
+            CModbusASCII framer(&stream, &stream, buffer, _countof(buffer));
+
+            while (stream.ticks() < 10)
+            {
+                framer.poll();
+                stream.increment(1);
+            }
+
+            // only the second frame should have been accepted
+            Assert::AreEqual(true, framer.frame_ready());
+            Assert::AreEqual((byte)18, framer.frame_address());
+            uint8_t response[] = { 0x03, 0x00, 0x6B, 0x00, 0x03 };
+            Assert::AreEqual((size_t)_countof(response), framer.buffer_len());
+            Assert::AreEqual(true, std::equal(response, response + _countof(response), framer.buffer()));
+        };
+
         [TestMethod]
         void TestReceiveInputOverflow()
         {
@@ -246,17 +441,63 @@ namespace UnitTests
                 stream.increment(1);
             }
 
-            // get the result
+            // get the result; the address, PDU and CRC must be sent in one writev() call
             std::vector<std::tr1::tuple<system_tick_t /*start*/, std::string /*data*/> > items;
             stream.written(items);
-
-
+            uint8_t expected[] = { 0x02, 0x07, 0x41, 0x12 };
+            Assert::AreEqual((size_t)1, items.size());
+            Assert::AreEqual(1, stream.m_writev_count);
+            Assert::AreEqual(true, std::string(expected, expected + _countof(expected)) == stream.write_data);
             Assert::AreEqual(false, stream.m_rx_status);
             Assert::AreEqual(false, stream.m_tx_status);
             Assert::AreEqual(0, stream.m_rx_on_count);
             Assert::AreEqual(1, stream.m_tx_on_count);
         }
 
+        [TestMethod]
+        void TestRTUTransmitPartialWrite()
+        {
+            CDummyStream stream;
+            stream.max_write = 3;
+            uint8_t buffer[MODBUS_DATA_BUFFER_SIZE];
+            CModbusRTU rtu(&stream, &stream, buffer, _countof(buffer));
+            rtu.setup(9600);
+
+            // skip some ticks to wait for the initial dump
+            while (stream.ticks() < 5)
+            {
+                rtu.poll();
+                stream.increment(1);
+            }
+
+            // send a frame that takes three writes
+            Assert::AreEqual(true, rtu.begin_send());
+            rtu.set_frame_address(0x11);
+            uint8_t data[] = { 0x03, 0x00, 0x6B, 0x00, 0x03 };
+            std::copy(data, data + _countof(data), rtu.buffer());
+            rtu.set_buffer_len(_countof(data));
+            rtu.send();
+
+            // wait for the transfer to happen
+            while (stream.ticks() < 20)
+            {
+                rtu.poll();
+                stream.increment(1);
+            }
+
+            // each write must carry on where the previous one stopped, across the address, PDU and CRC
+            std::vector<std::tr1::tuple<system_tick_t /*start*/, std::string /*data*/> > items;
+            stream.written(items);
+            uint8_t expected[] = { 0x11, 0x03, 0x00, 0x6B, 0x00, 0x03, 0x76, 0x87 };
+            Assert::AreEqual((size_t)3, items.size());
+            Assert::AreEqual(true, std::string(expected, expected + 3) == std::get<1>(items[0]));
+            Assert::AreEqual(true, std::string(expected + 3, expected + 6) == std::get<1>(items[1]));
+            Assert::AreEqual(true, std::string(expected + 6, expected + 8) == std::get<1>(items[2]));
+            Assert::AreEqual(true, std::string(expected, expected + _countof(expected)) == stream.write_data);
+            Assert::AreEqual(false, stream.m_tx_status);
+            Assert::AreEqual(1, stream.m_tx_on_count);
+        }
+
         [TestMethod]
         void TestASCIITransmitFrame()
         {
@@ -297,5 +538,115 @@ namespace UnitTests
             Assert::AreEqual(0, stream.m_rx_on_count);
             Assert::AreEqual(1, stream.m_tx_on_count);
         }
+
+        [TestMethod]
+        void TestReceiveTCPFrame()
+        {
+            std::vector<std::tr1::tuple<system_tick_t /*start*/, std::string /*data*/> > items;
+
+            // incoming datagram split across two reads
+            uint8_t frame1[] = { 0x12, 0x34, 0x00, 0x00, 0x00, 0x06, 0x11, 0x03, 0x00, 0x6B, 0x00, 0x03 };
+            items.push_back(std::tr1::make_tuple(2, std::string(frame1, frame1 + 4)));
+            items.push_back(std::tr1::make_tuple(3, std::string(frame1 + 4, frame1 + _countof(frame1))));
+
+            // parse the frames
+            CDummyStream stream(items);
+            uint8_t buffer[MODBUS_TCP_BUFFER_SIZE];
+            CModbusTCP framer(&stream, buffer, _countof(buffer));
+
+            while (stream.ticks() < 10)
+            {
+                framer.poll();
+                stream.increment(1);
+            }
+
+            // check the result
+            Assert::AreEqual(true, framer.frame_ready());
+            Assert::AreEqual((byte)0x11, framer.frame_address());
+            Assert::AreEqual((uint16_t)0x1234, framer.transaction_id());
+            uint8_t response[] = { 0x03, 0x00, 0x6B, 0x00, 0x03 };
+            Assert::AreEqual((size_t)_countof(response), framer.buffer_len());
+            Assert::AreEqual(true, std::equal(response, response + _countof(response), framer.buffer()));
+            Assert::AreEqual(false, stream.m_rx_status);
+            Assert::AreEqual(false, stream.m_tx_status);
+            Assert::AreEqual(1, stream.m_rx_on_count);
+            Assert::AreEqual(0, stream.m_tx_on_count);
+        };
+
+        [TestMethod]
+        void TestTCPTransmitFrame()
+        {
+            CDummyStream stream;
+            uint8_t buffer[MODBUS_TCP_BUFFER_SIZE];
+            CModbusTCP framer(&stream, buffer, _countof(buffer));
+
+            // aquire the buffer
+            Assert::AreEqual(true, framer.begin_send());
+
+            // update the data
+            framer.set_frame_address(17);
+            framer.set_transaction_id(0x1234);
+            uint8_t data[] = { 0x03, 0x00, 0x6B, 0x00, 0x03 };
+            std::copy(data, data + _countof(data), framer.buffer());
+            framer.set_buffer_len(_countof(data));
+
+            // begin the send
+            framer.send();
+
+            // wait for the transfer to happen
+            while (stream.ticks() < 10)
+            {
+                framer.poll();
+                stream.increment(1);
+            }
+
+            // check the result; the whole frame must be sent in one write
+            std::vector<std::tr1::tuple<system_tick_t /*start*/, std::string /*data*/> > items;
+            stream.written(items);
+            uint8_t expected[] = { 0x12, 0x34, 0x00, 0x00, 0x00, 0x06, 0x11, 0x03, 0x00, 0x6B, 0x00, 0x03 };
+            Assert::AreEqual((size_t)1, items.size());
+            Assert::AreEqual(true, std::string(expected, expected + _countof(expected)) == stream.write_data);
+            Assert::AreEqual(true, framer.idle());
+            Assert::AreEqual(false, stream.m_rx_status);
+            Assert::AreEqual(false, stream.m_tx_status);
+            Assert::AreEqual(0, stream.m_rx_on_count);
+            Assert::AreEqual(1, stream.m_tx_on_count);
+        }
+    };
+
+    [TestClass]
+    public ref class CRCTests
+    {
+    public: 
+
+        [TestMethod]
+        void TestCRC16CheckValue()
+        {
+            // check value for CRC-16/MODBUS
+            uint8_t data[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+            Assert::AreEqual((uint16_t)0x4b37, crc16_modbus(0xffff, data, _countof(data)));
+        }
+
+        [TestMethod]
+        void TestCRC16Implementations()
+        {
+            // all of the implementations must agree for every length and alignment
+            uint8_t data[MODBUS_DATA_BUFFER_SIZE + 8];
+            for (size_t i = 0; i < _countof(data); ++i)
+                data[i] = (uint8_t)(i * 131 + 7);
+
+            for (size_t offset = 0; offset < 8; ++offset)
+            {
+                for (size_t len = 0; len <= MODBUS_DATA_BUFFER_SIZE; ++len)
+                {
+                    uint16_t expected = crc16_modbus_bitwise(0xffff, data + offset, len);
+                    Assert::AreEqual(expected, crc16_modbus_nibble(0xffff, data + offset, len));
+                    Assert::AreEqual(expected, crc16_modbus_table(0xffff, data + offset, len));
+                    Assert::AreEqual(expected, crc16_modbus_slice4(0xffff, data + offset, len));
+                    Assert::AreEqual(expected, crc16_modbus_slice8(0xffff, data + offset, len));
+                    Assert::AreEqual(expected, crc16_modbus_clmul(0xffff, data + offset, len));
+                }
+            }
+        }
     };
 }
@@ -0,0 +1,869 @@
+#include "stdafx.h"
+#include "../../../../ModbusMaster.h"
+#include "../../../../ModbusTCP.h"
+#include "../../../../ModbusReadPlanner.h"
+#include "../../../../ModbusDataPoints.h"
+#include "../../../../ModbusUtil.h"
+#include "../../../../ModbusScanList.h"
+#include <algorithm>
+#include <string>
+#undef min
+
+using namespace System;
+using namespace System::Text;
+using namespace System::Collections::Generic;
+using namespace	Microsoft::VisualStudio::TestTools::UnitTesting;
+using namespace ModbusPotato;
+
+namespace UnitTests
+{
+#pragma region Dummy Classes
+    class CMasterStream : public ModbusPotato::IStream, public ModbusPotato::ITimeProvider
+    {
+    public:
+        CMasterStream()
+            :   m_time()
+            ,   m_rx_pos()
+        {
+        }
+        virtual int read(uint8_t* buffer, size_t buffer_size)
+        {
+            auto len = std::min(m_rx.size() - m_rx_pos, buffer_size);
+            if (buffer)
+                std::copy(m_rx.begin() + m_rx_pos, m_rx.begin() + m_rx_pos + len, buffer);
+            m_rx_pos += len;
+            return len;
+        }
+        virtual int write(uint8_t* buffer, size_t len)
+        {
+            write_data.insert(write_data.end(), buffer, buffer + len);
+            return len;
+        }
+        virtual void txEnable(bool state)
+        {
+        }
+        virtual bool writeComplete()
+        {
+            return true;
+        }
+        virtual system_tick_t ticks() const
+        {
+            return m_time;
+        }
+        virtual unsigned long microseconds_per_tick() const { return 1000; }
+        virtual void communicationStatus(bool rx, bool tx)
+        {
+        }
+        void increment(system_tick_t value)
+        {
+            m_time += value;
+        }
+        void feed(const uint8_t* data, size_t len)
+        {
+            m_rx.insert(m_rx.end(), data, data + len);
+        }
+        std::string write_data;
+    private:
+        system_tick_t m_time;
+        size_t m_rx_pos;
+        std::string m_rx;
+    };
+
+    class CMasterFramer : public IFramer
+    {
+    public:
+        CMasterFramer()
+            :   IFramer(NULL, NULL, m_data, _countof(m_data))
+            ,   sent_count()
+            ,   m_ready()
+        {
+        }
+        virtual unsigned long poll() { return 0; }
+        virtual bool begin_send() { return true; }
+        virtual void send() { sent_count++; }
+        virtual void finished() { m_ready = false; }
+        virtual bool frame_ready() const { return m_ready; }
+        void respond(uint8_t slave, const uint8_t* pdu, size_t len)
+        {
+            m_frame_address = slave;
+            std::copy(pdu, pdu + len, m_buffer);
+            m_buffer_len = len;
+            m_ready = true;
+            m_handler->frame_ready(this);
+        }
+        int sent_count;
+    private:
+        bool m_ready;
+        uint8_t m_data[MODBUS_DATA_BUFFER_SIZE];
+    };
+
+    // responds to a read holding registers request with the register addresses as the values
+    static void respond_registers(uint8_t* pdu, uint16_t address, uint16_t count)
+    {
+        *pdu++ = 0x03;
+        *pdu++ = (uint8_t)(2 * count);
+        for (uint16_t i = 0; i < count; ++i)
+        {
+            *pdu++ = (uint8_t)((address + i) >> 8);
+            *pdu++ = (uint8_t)(address + i);
+        }
+    }
+
+    class CMasterHandler : public IMasterHandler
+    {
+    public:
+        CMasterHandler()
+            :   last_address()
+            ,   last_count()
+            ,   response_count()
+            ,   time_out_count()
+            ,   block_count()
+            ,   exception_count()
+            ,   last_exception()
+            ,   chain_master()
+            ,   chain_buffer()
+            ,   chain_started()
+            ,   bits_function()
+            ,   error_count()
+        {
+            std::fill(last_values, last_values + _countof(last_values), 0);
+            std::fill(last_bits, last_bits + _countof(last_bits), 0);
+        }
+        uint16_t last_address;
+        size_t last_count;
+        uint16_t last_values[0x7d];
+        int response_count, time_out_count, block_count, exception_count;
+        modbus_exception_code::modbus_exception_code last_exception;
+        CModbusMaster* chain_master;            // starts another block read of 3 registers at 200 when set
+        uint16_t* chain_buffer;
+        bool chain_started;
+        uint8_t bits_function;                  // function code of the last bits response
+        uint8_t last_bits[0xfa];
+        int error_count;
+        virtual bool read_coils_rsp(uint16_t address, size_t n, const uint8_t* bits)
+        {
+            last_address = address;
+            last_count = n;
+            std::copy(bits, bits + (n + 7) / 8, last_bits);
+            bits_function = function_code::read_coil_status;
+            return true;
+        }
+        virtual bool read_discrete_inputs_rsp(uint16_t address, size_t n, const uint8_t* bits)
+        {
+            last_address = address;
+            last_count = n;
+            std::copy(bits, bits + (n + 7) / 8, last_bits);
+            bits_function = function_code::read_discrete_input_status;
+            return true;
+        }
+        virtual bool write_multiple_coils_rsp(uint16_t address, size_t n)
+        {
+            last_address = address;
+            last_count = n;
+            response_count++;
+            return true;
+        }
+        virtual bool read_holding_registers_rsp(uint16_t address, size_t count, const uint16_t* values)
+        {
+            last_address = address;
+            last_count = count;
+            std::copy(values, values + count, last_values);
+            response_count++;
+            return true;
+        }
+        virtual bool read_holding_registers_block_rsp(uint16_t address, size_t count, const uint16_t* values)
+        {
+            last_address = address;
+            last_count = count;
+            block_count++;
+            if (chain_master)
+            {
+                chain_started = chain_master->read_holding_registers_block_req(1, 200, 3, chain_buffer);
+                chain_master = NULL;
+            }
+            return true;
+        }
+        virtual bool response_time_out(void)
+        {
+            time_out_count++;
+            return true;
+        }
+        virtual bool exception_response(modbus_exception_code::modbus_exception_code code)
+        {
+            last_exception = code;
+            exception_count++;
+            return true;
+        }
+        virtual bool processing_error(void)
+        {
+            error_count++;
+            return true;
+        }
+    };
+
+    class CScanHandler : public CModbusScanList::IHandler
+    {
+    public:
+        CScanHandler()
+            :   miss_count()
+            ,   last_missed()
+        {
+        }
+        int miss_count;
+        unsigned long last_missed;
+        virtual void deadline_missed(const CModbusScanList::entry*, unsigned long missed)
+        {
+            miss_count++;
+            last_missed = missed;
+        }
+    };
+
+    class CPointsHandler : public CModbusDataPoints::IHandler
+    {
+    public:
+        CPointsHandler()
+            :   update_count()
+            ,   last_point()
+        {
+        }
+        int update_count;
+        const CModbusDataPoints::point* last_point;
+        virtual void updated(const CModbusDataPoints::point* p)
+        {
+            update_count++;
+            last_point = p;
+        }
+    };
+#pragma endregion
+
+    [TestClass]
+    public ref class MasterTests
+    {
+    public:
+
+        [TestMethod]
+        void TestPipelinedOutOfOrderResponse()
+        {
+            CMasterStream stream;
+            uint8_t buffer[MODBUS_TCP_BUFFER_SIZE];
+            CModbusTCP framer(&stream, buffer, _countof(buffer));
+            CMasterHandler handler;
+            CModbusMaster::transaction transactions[2];
+            CModbusMaster master(&handler, &framer, &stream, transactions, _countof(transactions));
+            framer.set_handler(&master);
+
+            // send two requests; the framer must be polled to send the first one before the next can be queued
+            Assert::AreEqual(true, master.read_holding_registers_req(1, 0x0010, 1));
+            Assert::AreEqual((uint16_t)0x0000, master.current()->id);
+            Assert::AreEqual(false, master.read_holding_registers_req(2, 0x0020, 1));
+            framer.poll();
+            Assert::AreEqual(true, master.read_holding_registers_req(2, 0x0020, 1));
+            Assert::AreEqual((uint16_t)0x0001, master.current()->id);
+            framer.poll();
+            Assert::AreEqual((size_t)2, master.pending());
+
+            // the second request is answered first
+            uint8_t frame2[] = { 0x00, 0x01, 0x00, 0x00, 0x00, 0x05, 0x02, 0x03, 0x02, 0x12, 0x34 };
+            stream.feed(frame2, _countof(frame2));
+            framer.poll();
+            Assert::AreEqual(1, handler.response_count);
+            Assert::AreEqual((uint16_t)0x0020, handler.last_address);
+            Assert::AreEqual((size_t)1, handler.last_count);
+            Assert::AreEqual((uint16_t)0x1234, handler.last_values[0]);
+            Assert::AreEqual((size_t)1, master.pending());
+
+            // then the first one
+            uint8_t frame1[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x01, 0x03, 0x02, 0x56, 0x78 };
+            stream.feed(frame1, _countof(frame1));
+            framer.poll();
+            Assert::AreEqual(2, handler.response_count);
+            Assert::AreEqual((uint16_t)0x0010, handler.last_address);
+            Assert::AreEqual((uint16_t)0x5678, handler.last_values[0]);
+            Assert::AreEqual((size_t)0, master.pending());
+            Assert::AreEqual(0, handler.time_out_count);
+        }
+
+        [TestMethod]
+        void TestPipelinedTimeOut()
+        {
+            CMasterStream stream;
+            uint8_t buffer[MODBUS_TCP_BUFFER_SIZE];
+            CModbusTCP framer(&stream, buffer, _countof(buffer));
+            CMasterHandler handler;
+            CModbusMaster::transaction transactions[1];
+            CModbusMaster master(&handler, &framer, &stream, transactions, _countof(transactions), 200);
+            framer.set_handler(&master);
+
+            // fill the only slot
+            Assert::AreEqual(true, master.read_holding_registers_req(1, 0x0010, 1));
+            framer.poll();
+            Assert::AreEqual(false, master.read_holding_registers_req(1, 0x0020, 1));
+
+            // nothing happens until the time out has elapsed
+            stream.increment(200);
+            master.poll();
+            Assert::AreEqual(0, handler.time_out_count);
+            Assert::AreEqual((size_t)1, master.pending());
+
+            // the time out frees the slot for the next request
+            stream.increment(1);
+            master.poll();
+            Assert::AreEqual(1, handler.time_out_count);
+            Assert::AreEqual((size_t)0, master.pending());
+            Assert::AreEqual(true, master.read_holding_registers_req(1, 0x0020, 1));
+            Assert::AreEqual((size_t)1, master.pending());
+        }
+
+        [TestMethod]
+        void TestPipelinedLateResponse()
+        {
+            CMasterStream stream;
+            uint8_t buffer[MODBUS_TCP_BUFFER_SIZE];
+            CModbusTCP framer(&stream, buffer, _countof(buffer));
+            CMasterHandler handler;
+            CModbusMaster::transaction transactions[1];
+            CModbusMaster master(&handler, &framer, &stream, transactions, _countof(transactions), 200);
+            framer.set_handler(&master);
+
+            // let the first request time out
+            Assert::AreEqual(true, master.read_holding_registers_req(1, 0x0010, 1));
+            framer.poll();
+            stream.increment(201);
+            master.poll();
+            Assert::AreEqual(1, handler.time_out_count);
+
+            // re-use the slot for a second request
+            Assert::AreEqual(true, master.read_holding_registers_req(1, 0x0020, 1));
+            Assert::AreEqual((uint16_t)0x0001, master.current()->id);
+            framer.poll();
+
+            // the late response to the first request is dropped
+            uint8_t late[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x01, 0x03, 0x02, 0x56, 0x78 };
+            stream.feed(late, _countof(late));
+            framer.poll();
+            Assert::AreEqual(0, handler.response_count);
+            Assert::AreEqual((size_t)1, master.pending());
+            Assert::AreEqual(true, framer.idle());
+
+            // while the second one is still matched
+            uint8_t frame[] = { 0x00, 0x01, 0x00, 0x00, 0x00, 0x05, 0x01, 0x03, 0x02, 0x12, 0x34 };
+            stream.feed(frame, _countof(frame));
+            framer.poll();
+            Assert::AreEqual(1, handler.response_count);
+            Assert::AreEqual((uint16_t)0x0020, handler.last_address);
+            Assert::AreEqual((uint16_t)0x1234, handler.last_values[0]);
+            Assert::AreEqual((size_t)0, master.pending());
+        }
+
+        [TestMethod]
+        void TestBlockReadChained()
+        {
+            CMasterStream stream;
+            CMasterFramer framer;
+            CMasterHandler handler;
+            CModbusMaster master(&handler, &framer, &stream);
+            framer.set_handler(&master);
+            uint16_t first[130], second[3];
+            handler.chain_master = &master;
+            handler.chain_buffer = second;
+
+            // the first block takes two requests
+            uint8_t pdu[MODBUS_DATA_BUFFER_SIZE];
+            Assert::AreEqual(true, master.read_holding_registers_block_req(1, 0, _countof(first), first));
+            Assert::AreEqual(1, framer.sent_count);
+            respond_registers(pdu, 0, 125);
+            framer.respond(1, pdu, 2 + 2 * 125);
+            Assert::AreEqual(2, framer.sent_count);
+            Assert::AreEqual(0, handler.block_count);
+            respond_registers(pdu, 125, 5);
+            framer.respond(1, pdu, 2 + 2 * 5);
+            Assert::AreEqual(1, handler.block_count);
+            Assert::AreEqual((uint16_t)0, handler.last_address);
+            Assert::AreEqual((size_t)130, handler.last_count);
+            Assert::AreEqual((uint16_t)129, first[129]);
+
+            // the second block was started from the callback of the first one, and is sent right after it
+            Assert::AreEqual(true, handler.chain_started);
+            Assert::AreEqual(true, master.block_busy());
+            Assert::AreEqual(3, framer.sent_count);
+            uint8_t request[] = { 0x03, 0x00, 0xC8, 0x00, 0x03 };
+            Assert::AreEqual((size_t)_countof(request), framer.buffer_len());
+            Assert::AreEqual(true, std::equal(request, request + _countof(request), framer.buffer()));
+            respond_registers(pdu, 200, 3);
+            framer.respond(1, pdu, 2 + 2 * 3);
+            Assert::AreEqual(2, handler.block_count);
+            Assert::AreEqual((uint16_t)200, handler.last_address);
+            Assert::AreEqual((size_t)3, handler.last_count);
+            Assert::AreEqual((uint16_t)202, second[2]);
+            Assert::AreEqual(false, master.block_busy());
+        }
+
+        [TestMethod]
+        void TestPipelinedBlockReadChained()
+        {
+            CMasterStream stream;
+            uint8_t buffer[MODBUS_TCP_BUFFER_SIZE];
+            CModbusTCP framer(&stream, buffer, _countof(buffer));
+            CMasterHandler handler;
+            CModbusMaster::transaction transactions[1];
+            CModbusMaster master(&handler, &framer, &stream, transactions, _countof(transactions));
+            framer.set_handler(&master);
+            uint16_t first[3], second[3];
+            handler.chain_master = &master;
+            handler.chain_buffer = second;
+
+            // complete the first block
+            Assert::AreEqual(true, master.read_holding_registers_block_req(1, 0, _countof(first), first));
+            framer.poll();
+            uint8_t frame1[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x09, 0x01, 0x03, 0x06, 0x00, 0x01, 0x00, 0x02, 0x00, 0x03 };
+            stream.feed(frame1, _countof(frame1));
+            stream.write_data.clear();
+            framer.poll();
+            Assert::AreEqual(1, handler.block_count);
+            Assert::AreEqual((uint16_t)3, first[2]);
+
+            // the second block was sent with a new transaction id
+            Assert::AreEqual(true, handler.chain_started);
+            Assert::AreEqual((size_t)1, master.pending());
+            uint8_t request[] = { 0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0x01, 0x03, 0x00, 0xC8, 0x00, 0x03 };
+            Assert::AreEqual(true, std::string(request, request + _countof(request)) == stream.write_data);
+            uint8_t frame2[] = { 0x00, 0x01, 0x00, 0x00, 0x00, 0x09, 0x01, 0x03, 0x06, 0x00, 0x04, 0x00, 0x05, 0x00, 0x06 };
+            stream.feed(frame2, _countof(frame2));
+            framer.poll();
+            Assert::AreEqual(2, handler.block_count);
+            Assert::AreEqual((uint16_t)200, handler.last_address);
+            Assert::AreEqual((uint16_t)6, second[2]);
+            Assert::AreEqual((size_t)0, master.pending());
+        }
+
+        [TestMethod]
+        void TestBlockReadException()
+        {
+            CMasterStream stream;
+            uint8_t buffer[MODBUS_TCP_BUFFER_SIZE];
+            CModbusTCP framer(&stream, buffer, _countof(buffer));
+            CMasterHandler handler;
+            CModbusMaster::transaction transactions[2];
+            CModbusMaster master(&handler, &framer, &stream, transactions, _countof(transactions));
+            framer.set_handler(&master);
+            uint16_t values[250];
+
+            // both parts of the block are outstanding
+            Assert::AreEqual(true, master.read_holding_registers_block_req(1, 0, _countof(values), values));
+            framer.poll();
+            master.poll();
+            framer.poll();
+            Assert::AreEqual((size_t)2, master.pending());
+
+            // an exception for the first part aborts the block and frees the slot of the second one
+            uint8_t exception[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x01, 0x83, 0x02 };
+            stream.feed(exception, _countof(exception));
+            framer.poll();
+            Assert::AreEqual(1, handler.exception_count);
+            Assert::AreEqual(modbus_exception_code::illegal_data_address, handler.last_exception);
+            Assert::AreEqual(false, master.block_busy());
+            Assert::AreEqual((size_t)0, master.pending());
+
+            // the response to the second part is ignored
+            uint8_t frame[MODBUS_TCP_BUFFER_SIZE] = { 0x00, 0x01, 0x00, 0x00, 0x00, 0xFD, 0x01 };
+            respond_registers(frame + 7, 125, 125);
+            stream.feed(frame, 7 + 2 + 2 * 125);
+            framer.poll();
+            Assert::AreEqual(0, handler.block_count);
+            Assert::AreEqual(true, framer.idle());
+        }
+
+        [TestMethod]
+        void TestScanListOrder()
+        {
+            CMasterStream stream;
+            CMasterFramer framer;
+            CMasterHandler handler;
+            CModbusMaster master(&handler, &framer, &stream);
+            framer.set_handler(&master);
+            CModbusScanList::entry entries[] = {
+                { 1, function_code::read_holding_registers, 0, 1, 100, 1 },
+                { 1, function_code::read_holding_registers, 10, 1, 50, 0 },
+                { 1, function_code::read_holding_registers, 20, 1, 100, 0 },
+                { 1, function_code::read_holding_registers, 30, 0, 10, 0 },
+            };
+            CModbusScanList scan(&master, &stream, entries, _countof(entries));
+
+            // the invalid entry has the earliest deadline but is skipped; the shortest period goes first
+            uint8_t pdu[MODBUS_DATA_BUFFER_SIZE];
+            scan.poll();
+            Assert::AreEqual(1, framer.sent_count);
+            Assert::AreEqual((uint8_t)10, framer.buffer()[2]);
+            Assert::AreEqual(true, entries[3].done);
+            Assert::AreEqual(true, scan.current() == &entries[1]);
+
+            // nothing else is sent until the response is in
+            scan.poll();
+            Assert::AreEqual(1, framer.sent_count);
+            respond_registers(pdu, 10, 1);
+            framer.respond(1, pdu, 4);
+
+            // the priority breaks the tie between the two entries with the same deadline
+            scan.poll();
+            Assert::AreEqual(2, framer.sent_count);
+            Assert::AreEqual((uint8_t)20, framer.buffer()[2]);
+            respond_registers(pdu, 20, 1);
+            framer.respond(1, pdu, 4);
+            scan.poll();
+            Assert::AreEqual(3, framer.sent_count);
+            Assert::AreEqual((uint8_t)0, framer.buffer()[2]);
+            respond_registers(pdu, 0, 1);
+            framer.respond(1, pdu, 4);
+
+            // every entry has been read in this period
+            scan.poll();
+            Assert::AreEqual(3, framer.sent_count);
+            Assert::AreEqual(3, handler.response_count);
+        }
+
+        [TestMethod]
+        void TestScanListDeadlineMissed()
+        {
+            CMasterStream stream;
+            CMasterFramer framer;
+            CMasterHandler handler;
+            CModbusMaster master(&handler, &framer, &stream);
+            framer.set_handler(&master);
+            CModbusScanList::entry entries[] = {
+                { 1, function_code::read_holding_registers, 0, 1, 10, 0 },
+            };
+            CScanHandler scan_handler;
+            CModbusScanList scan(&master, &stream, entries, _countof(entries), &scan_handler);
+
+            // the slave never responds, so the master stays busy
+            scan.poll();
+            Assert::AreEqual(1, framer.sent_count);
+
+            // the entry was sent in the first period, so only the two after it are missed
+            stream.increment(35);
+            scan.poll();
+            Assert::AreEqual(1, framer.sent_count);
+            Assert::AreEqual(2ul, entries[0].misses);
+            Assert::AreEqual(1, scan_handler.miss_count);
+            Assert::AreEqual(2ul, scan_handler.last_missed);
+
+            // the current period is missed too, since it was not sent in it
+            stream.increment(10);
+            scan.poll();
+            Assert::AreEqual(3ul, entries[0].misses);
+            Assert::AreEqual(2, scan_handler.miss_count);
+            Assert::AreEqual(1ul, scan_handler.last_missed);
+        }
+
+        [TestMethod]
+        void TestReadPlannerErrors()
+        {
+            CMasterStream stream;
+            CMasterFramer framer;
+            CMasterHandler fallback, holding1, holding2, input;
+            CModbusReadPlanner planner(&fallback);
+            CModbusMaster master(&planner, &framer, &stream);
+            planner.set_master(&master);
+            framer.set_handler(&master);
+            CModbusReadPlanner::point points[] = {
+                { 1, function_code::read_holding_registers, 0, 2, &holding1 },
+                { 1, function_code::read_holding_registers, 3, 1, &holding2 },
+                { 1, function_code::read_input_registers, 0, 4, &input },
+            };
+            CModbusReadPlanner::block blocks[2];
+            Assert::AreEqual((size_t)2, planner.plan(points, _countof(points), blocks, _countof(blocks), 1));
+
+            // a time out of the holding register block is reported to both of its points
+            Assert::AreEqual(true, planner.read_req(&blocks[0]));
+            stream.increment(201);
+            master.poll();
+            Assert::AreEqual(1, holding1.time_out_count);
+            Assert::AreEqual(1, holding2.time_out_count);
+            Assert::AreEqual(0, input.time_out_count);
+            Assert::AreEqual(0, fallback.time_out_count);
+
+            // so is an exception, but not to the point of the input register block at the same address
+            Assert::AreEqual(true, planner.read_req(&blocks[0]));
+            uint8_t exception[] = { 0x83, 0x02 };
+            framer.respond(1, exception, _countof(exception));
+            Assert::AreEqual(1, holding1.exception_count);
+            Assert::AreEqual(1, holding2.exception_count);
+            Assert::AreEqual(0, input.exception_count);
+            Assert::AreEqual(0, fallback.exception_count);
+
+            // errors of other requests still go to the fallback handler
+            Assert::AreEqual(true, master.read_holding_registers_req(1, 0, 3));
+            stream.increment(201);
+            master.poll();
+            Assert::AreEqual(1, fallback.time_out_count);
+            Assert::AreEqual(1, holding1.time_out_count);
+        }
+
+        [TestMethod]
+        void TestReadPlannerMerge()
+        {
+            CMasterStream stream;
+            CMasterFramer framer;
+            CMasterHandler fallback, a, b, c, d, e, f, g;
+            CModbusReadPlanner planner(&fallback);
+            CModbusMaster master(&planner, &framer, &stream);
+            planner.set_master(&master);
+            framer.set_handler(&master);
+            CModbusReadPlanner::point points[] = {
+                { 1, function_code::read_holding_registers, 10, 2, &a },
+                { 2, function_code::read_holding_registers, 100, 30, &e },
+                { 1, function_code::read_holding_registers, 0, 4, &b },
+                { 1, function_code::read_holding_registers, 20, 1, &d },
+                { 2, function_code::read_holding_registers, 0, 100, &f },
+                { 1, function_code::read_holding_registers, 6, 2, &c },
+                { 2, function_code::read_holding_registers, 130, 20, &g },
+            };
+            CModbusReadPlanner::block blocks[4];
+            Assert::AreEqual((size_t)0, planner.plan(points, _countof(points), blocks, 3, 2));
+            Assert::AreEqual((size_t)4, planner.plan(points, _countof(points), blocks, _countof(blocks), 2));
+
+            // points up to 2 registers apart are merged, and a point further away starts a new block
+            Assert::AreEqual((uint8_t)1, blocks[0].slave);
+            Assert::AreEqual((uint16_t)0, blocks[0].address);
+            Assert::AreEqual((uint16_t)12, blocks[0].count);
+            Assert::AreEqual((size_t)3, blocks[0].n);
+            Assert::AreEqual((uint16_t)20, blocks[1].address);
+            Assert::AreEqual((uint16_t)1, blocks[1].count);
+
+            // adjacent points are split where the block would grow past 125 registers
+            Assert::AreEqual((uint8_t)2, blocks[2].slave);
+            Assert::AreEqual((uint16_t)0, blocks[2].address);
+            Assert::AreEqual((uint16_t)100, blocks[2].count);
+            Assert::AreEqual((size_t)1, blocks[2].n);
+            Assert::AreEqual((uint16_t)100, blocks[3].address);
+            Assert::AreEqual((uint16_t)50, blocks[3].count);
+            Assert::AreEqual((size_t)2, blocks[3].n);
+
+            // each point gets its own part of the response, and the registers in the gaps are dropped
+            uint8_t pdu[MODBUS_DATA_BUFFER_SIZE];
+            Assert::AreEqual(true, planner.read_req(&blocks[0]));
+            respond_registers(pdu, 0, 12);
+            framer.respond(1, pdu, 2 + 2 * 12);
+            Assert::AreEqual((uint16_t)0, b.last_address);
+            Assert::AreEqual((size_t)4, b.last_count);
+            Assert::AreEqual((uint16_t)3, b.last_values[3]);
+            Assert::AreEqual((uint16_t)6, c.last_address);
+            Assert::AreEqual((size_t)2, c.last_count);
+            Assert::AreEqual((uint16_t)6, c.last_values[0]);
+            Assert::AreEqual((uint16_t)10, a.last_address);
+            Assert::AreEqual((uint16_t)11, a.last_values[1]);
+            Assert::AreEqual(0, d.response_count);
+            Assert::AreEqual(0, fallback.response_count);
+
+            Assert::AreEqual(true, planner.read_req(&blocks[3]));
+            respond_registers(pdu, 100, 50);
+            framer.respond(2, pdu, 2 + 2 * 50);
+            Assert::AreEqual((uint16_t)100, e.last_values[0]);
+            Assert::AreEqual((size_t)30, e.last_count);
+            Assert::AreEqual((uint16_t)130, g.last_values[0]);
+            Assert::AreEqual((uint16_t)149, g.last_values[19]);
+            Assert::AreEqual(0, f.response_count);
+
+            // a response that does not match a block is passed on as it is
+            Assert::AreEqual(true, master.read_holding_registers_req(1, 0, 4));
+            respond_registers(pdu, 0, 4);
+            framer.respond(1, pdu, 2 + 2 * 4);
+            Assert::AreEqual(1, fallback.response_count);
+            Assert::AreEqual((size_t)4, fallback.last_count);
+            Assert::AreEqual(1, b.response_count);
+
+            // and so is one from another slave
+            Assert::AreEqual(true, master.read_holding_registers_req(3, 0, 12));
+            respond_registers(pdu, 0, 12);
+            framer.respond(3, pdu, 2 + 2 * 12);
+            Assert::AreEqual(2, fallback.response_count);
+            Assert::AreEqual(1, b.response_count);
+        }
+
+        [TestMethod]
+        void TestReadBits()
+        {
+            CMasterStream stream;
+            CMasterFramer framer;
+            CMasterHandler handler;
+            CModbusMaster master(&handler, &framer, &stream);
+            framer.set_handler(&master);
+
+            // read 19 coils; the bits are passed on packed
+            Assert::AreEqual(true, master.read_coils_req(1, 0x0013, 19));
+            uint8_t coils_request[] = { 0x01, 0x00, 0x13, 0x00, 0x13 };
+            Assert::AreEqual((size_t)_countof(coils_request), framer.buffer_len());
+            Assert::AreEqual(true, std::equal(coils_request, coils_request + _countof(coils_request), framer.buffer()));
+            uint8_t coils[] = { 0x01, 0x03, 0xCD, 0x6B, 0x05 };
+            framer.respond(1, coils, _countof(coils));
+            Assert::AreEqual((uint8_t)function_code::read_coil_status, handler.bits_function);
+            Assert::AreEqual((uint16_t)0x0013, handler.last_address);
+            Assert::AreEqual((size_t)19, handler.last_count);
+            Assert::AreEqual(true, std::equal(coils + 2, coils + _countof(coils), handler.last_bits));
+
+            // read 22 discrete inputs
+            Assert::AreEqual(true, master.read_discrete_inputs_req(1, 0x00C4, 22));
+            uint8_t inputs_request[] = { 0x02, 0x00, 0xC4, 0x00, 0x16 };
+            Assert::AreEqual(true, std::equal(inputs_request, inputs_request + _countof(inputs_request), framer.buffer()));
+            uint8_t inputs[] = { 0x02, 0x03, 0xAC, 0xDB, 0x35 };
+            framer.respond(1, inputs, _countof(inputs));
+            Assert::AreEqual((uint8_t)function_code::read_discrete_input_status, handler.bits_function);
+            Assert::AreEqual((uint16_t)0x00C4, handler.last_address);
+            Assert::AreEqual((size_t)22, handler.last_count);
+            Assert::AreEqual(true, std::equal(inputs + 2, inputs + _countof(inputs), handler.last_bits));
+            Assert::AreEqual(0, handler.error_count);
+
+            // the byte count must match the number of coils requested, whether it is too short or too long
+            handler.bits_function = 0;
+            Assert::AreEqual(true, master.read_coils_req(1, 0x0013, 19));
+            uint8_t short_count[] = { 0x01, 0x02, 0xCD, 0x6B };
+            framer.respond(1, short_count, _countof(short_count));
+            Assert::AreEqual(1, handler.error_count);
+            Assert::AreEqual(true, master.read_coils_req(1, 0x0013, 19));
+            uint8_t long_count[] = { 0x01, 0x04, 0xCD, 0x6B, 0x05, 0x00 };
+            framer.respond(1, long_count, _countof(long_count));
+            Assert::AreEqual(2, handler.error_count);
+            Assert::AreEqual((uint8_t)0, handler.bits_function);
+
+            // up to 2000 bits can be read at once
+            Assert::AreEqual(false, master.read_coils_req(1, 0, 0));
+            Assert::AreEqual(false, master.read_coils_req(1, 0, 0x7d1));
+            Assert::AreEqual(false, master.read_discrete_inputs_req(1, 0, 0x7d1));
+            Assert::AreEqual(true, master.read_discrete_inputs_req(1, 0, 0x7d0));
+            Assert::AreEqual((uint8_t)0x07, framer.buffer()[3]);
+            Assert::AreEqual((uint8_t)0xD0, framer.buffer()[4]);
+        }
+
+        [TestMethod]
+        void TestWriteMultipleCoils()
+        {
+            CMasterStream stream;
+            CMasterFramer framer;
+            CMasterHandler handler;
+            CModbusMaster master(&handler, &framer, &stream);
+            framer.set_handler(&master);
+
+            // the packed bits are copied with the unused bits of the last byte cleared
+            uint8_t bits[] = { 0xCD, 0xFF };
+            Assert::AreEqual(true, master.write_multiple_coils_req(1, 0x0013, 10, bits));
+            uint8_t packed_request[] = { 0x0F, 0x00, 0x13, 0x00, 0x0A, 0x02, 0xCD, 0x03 };
+            Assert::AreEqual((size_t)_countof(packed_request), framer.buffer_len());
+            Assert::AreEqual(true, std::equal(packed_request, packed_request + _countof(packed_request), framer.buffer()));
+            uint8_t response[] = { 0x0F, 0x00, 0x13, 0x00, 0x0A };
+            framer.respond(1, response, _countof(response));
+            Assert::AreEqual(1, handler.response_count);
+            Assert::AreEqual((uint16_t)0x0013, handler.last_address);
+            Assert::AreEqual((size_t)10, handler.last_count);
+
+            // the values are packed with the first coil in the least significant bit
+            bool values[] = { true, false, true, true, false, false, true, true, true, false };
+            Assert::AreEqual(true, master.write_multiple_coils_req(1, 0x0013, _countof(values), values));
+            uint8_t values_request[] = { 0x0F, 0x00, 0x13, 0x00, 0x0A, 0x02, 0xCD, 0x01 };
+            Assert::AreEqual((size_t)_countof(values_request), framer.buffer_len());
+            Assert::AreEqual(true, std::equal(values_request, values_request + _countof(values_request), framer.buffer()));
+            framer.respond(1, response, _countof(response));
+            Assert::AreEqual(2, handler.response_count);
+
+            // up to 1968 coils can be written at once
+            uint8_t many[0xf7] = {};
+            Assert::AreEqual(false, master.write_multiple_coils_req(1, 0, 0x7b1, many));
+            Assert::AreEqual(true, master.write_multiple_coils_req(1, 0, 0x7b0, many));
+            Assert::AreEqual((size_t)6 + 0xf6, framer.buffer_len());
+        }
+    };
+
+    [TestClass]
+    public ref class DataPointsTests
+    {
+    public:
+
+        [TestMethod]
+        void TestWordOrders()
+        {
+            // 123.456f, -123456789 and 0x0102030405060708 in each word order
+            static const word_order::word_order orders[] = { word_order::abcd, word_order::cdab, word_order::badc, word_order::dcba };
+            static const uint16_t float32_registers[][2] = {
+                { 0x42F6, 0xE979 }, { 0xE979, 0x42F6 }, { 0xF642, 0x79E9 }, { 0x79E9, 0xF642 },
+            };
+            static const uint16_t int32_registers[][2] = {
+                { 0xF8A4, 0x32EB }, { 0x32EB, 0xF8A4 }, { 0xA4F8, 0xEB32 }, { 0xEB32, 0xA4F8 },
+            };
+            static const uint16_t uint64_registers[][4] = {
+                { 0x0102, 0x0304, 0x0506, 0x0708 }, { 0x0708, 0x0506, 0x0304, 0x0102 },
+                { 0x0201, 0x0403, 0x0605, 0x0807 }, { 0x0807, 0x0605, 0x0403, 0x0201 },
+            };
+
+            for (size_t i = 0; i < _countof(orders); ++i)
+            {
+                // decode
+                float f = 0;
+                int32_t l = 0;
+                uint64_t q = 0;
+                Assert::AreEqual(true, decode_values(float32_registers[i], 1, data_type::float32, orders[i], &f));
+                Assert::AreEqual(123.456f, f);
+                Assert::AreEqual(true, decode_values(int32_registers[i], 1, data_type::int32, orders[i], &l));
+                Assert::AreEqual(-123456789, l);
+                Assert::AreEqual(true, decode_values(uint64_registers[i], 1, data_type::uint64, orders[i], &q));
+                Assert::AreEqual((uint64_t)0x0102030405060708ull, q);
+
+                // and encode back to the same registers
+                uint16_t registers[4];
+                Assert::AreEqual(true, encode_values(&f, 1, data_type::float32, orders[i], registers));
+                Assert::AreEqual(true, std::equal(registers, registers + 2, float32_registers[i]));
+                Assert::AreEqual(true, encode_values(&l, 1, data_type::int32, orders[i], registers));
+                Assert::AreEqual(true, std::equal(registers, registers + 2, int32_registers[i]));
+                Assert::AreEqual(true, encode_values(&q, 1, data_type::uint64, orders[i], registers));
+                Assert::AreEqual(true, std::equal(registers, registers + 4, uint64_registers[i]));
+            }
+        }
+
+        [TestMethod]
+        void TestDataPointsPartialResponse()
+        {
+            CMasterStream stream;
+            CMasterFramer framer;
+            CMasterHandler fallback;
+            float temperature = 0;
+            uint32_t counters[2] = {};
+            CModbusDataPoints::point points[] = {
+                { 1, function_code::read_holding_registers, 0, data_type::float32, 1, &temperature },
+                { 1, function_code::read_holding_registers, 2, data_type::uint32, 2, counters },
+            };
+            CPointsHandler points_handler;
+            CModbusDataPoints data(points, _countof(points), &points_handler, &fallback);
+            CModbusMaster master(&data, &framer, &stream);
+            data.set_master(&master);
+            framer.set_handler(&master);
+
+            // only the point that is entirely within the response is decoded
+            Assert::AreEqual(true, master.read_holding_registers_req(1, 0, 4));
+            uint8_t first[] = { 0x03, 0x08, 0x42, 0xF6, 0xE9, 0x79, 0x00, 0x00, 0x00, 0x01 };
+            framer.respond(1, first, _countof(first));
+            Assert::AreEqual(123.456f, temperature);
+            Assert::AreEqual(1, points_handler.update_count);
+            Assert::AreEqual(true, points_handler.last_point == &points[0]);
+            Assert::AreEqual((uint32_t)0, counters[0]);
+            Assert::AreEqual(0, fallback.response_count);
+
+            // a response that only covers part of a point leaves it alone and is passed on
+            Assert::AreEqual(true, master.read_holding_registers_req(1, 2, 2));
+            uint8_t second[] = { 0x03, 0x04, 0x00, 0x00, 0x00, 0x01 };
+            framer.respond(1, second, _countof(second));
+            Assert::AreEqual(1, points_handler.update_count);
+            Assert::AreEqual((uint32_t)0, counters[0]);
+            Assert::AreEqual(1, fallback.response_count);
+            Assert::AreEqual((uint16_t)2, fallback.last_address);
+            Assert::AreEqual((size_t)2, fallback.last_count);
+
+            // until one covers all of it
+            Assert::AreEqual(true, master.read_holding_registers_req(1, 2, 4));
+            uint8_t third[] = { 0x03, 0x08, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x02 };
+            framer.respond(1, third, _countof(third));
+            Assert::AreEqual(2, points_handler.update_count);
+            Assert::AreEqual(true, points_handler.last_point == &points[1]);
+            Assert::AreEqual((uint32_t)1, counters[0]);
+            Assert::AreEqual((uint32_t)2, counters[1]);
+            Assert::AreEqual(1, fallback.response_count);
+        }
+    };
+}
@@ -1,6 +1,8 @@
 #include "stdafx.h"
 #include "../../../../ModbusSlave.h"
-#include "../../../../ModbusSlaveHandlerBase.h"
+#include "../../../../ModbusSlaveHandlerBank.h"
+#include "../../../../ModbusSlaveHandlerCoils.h"
+#include "../../../../ModbusSlaveHandlerMap.h"
 #include <algorithm>
 #pragma comment(lib, "Ws2_32.lib")
 
@@ -17,36 +19,23 @@ namespace UnitTests
     {
     public:
         CFramerDummy()
-            :   m_station_address()
-            ,   m_frame_address()
-            ,   m_buffer_len()
+            :   IFramer(NULL, NULL, m_data, sizeof(m_data))
             ,   was_sent()
             ,   was_finished()
         {
         }
-        virtual void set_handler(IFrameHandler* handler) { }
-        virtual uint8_t station_address() const { return m_station_address; }
-        virtual void set_station_address(uint8_t address) { m_station_address = address; }
         virtual unsigned long poll() { return 0; }
         virtual bool begin_send() { return true; }
         virtual void send() { was_sent = true; }
         virtual void finished() { was_finished = true; }
         virtual bool frame_ready() const { return true; }
-        virtual uint8_t frame_address() const { return m_frame_address; }
-        virtual void set_frame_address(uint8_t address) { m_frame_address = address; }
-        virtual uint8_t* buffer() { return m_buffer; }
-        virtual size_t buffer_len() const { return m_buffer_len; }
-        virtual void set_buffer_len(size_t len) { m_buffer_len = len; }
-        virtual size_t buffer_max() const { return _countof(m_buffer); }
         bool was_sent;
         bool was_finished;
     private:
-        uint8_t m_station_address, m_frame_address;
-        size_t m_buffer_len;
-        uint8_t m_buffer[256];
+        uint8_t m_data[256];
     };
 
-    class CSlaveHandler : public CModbusSlaveHandlerBase
+    class CSlaveHandler : public ISlaveHandler
     {
     public:
         CSlaveHandler()
@@ -109,6 +98,45 @@ namespace UnitTests
         }
     };
 
+    class CBigEndianSlaveHandler : public ISlaveHandler
+    {
+    public:
+        CBigEndianSlaveHandler()
+        {
+            std::fill(registers, registers + _countof(registers), 0);
+        }
+        uint16_t registers[4];
+        virtual bool big_endian_registers() const { return true; }
+        virtual modbus_exception_code::modbus_exception_code read_holding_registers(uint16_t address, uint16_t count, uint16_t* result)
+        {
+            std::copy(registers + address, registers + address + count, result);
+            return modbus_exception_code::ok;
+        }
+        virtual modbus_exception_code::modbus_exception_code write_multiple_registers(uint16_t address, uint16_t count, const uint16_t* values)
+        {
+            std::copy(values, values + count, registers + address);
+            return modbus_exception_code::ok;
+        }
+    };
+
+    class CFunctionHandler : public IFunctionHandler
+    {
+    public:
+        CFunctionHandler()
+            :   was_called()
+        {
+        }
+        bool was_called;
+        virtual uint8_t execute(IFramer* framer, ISlaveHandler* handler)
+        {
+            was_called = true;
+
+            // echo back the request with the sub-function incremented
+            framer->buffer()[1]++;
+            return modbus_exception_code::ok;
+        }
+    };
+
 #pragma endregion
 
 	[TestClass]
@@ -403,5 +431,313 @@ namespace UnitTests
             Assert::AreEqual((uint8_t)0x00, framer.buffer()[3]); // count H
             Assert::AreEqual((uint8_t)0x02, framer.buffer()[4]); // count L
 		}
+
+        // FC22
+        [TestMethod]
+		void TestSlaveFC22MaskWriteRegister()
+		{
+            // create the slave object
+            CSlaveHandler handler;
+            CModbusSlave slave(&handler);
+
+            // initialize with a test packet
+            // from http://www.modbus.org/docs/Modbus_Application_Protocol_V1_1b3.pdf
+            CFramerDummy framer;
+            framer.set_frame_address(0x11);
+            uint8_t data[] = { 0x16, 0x00, 0x04, 0x00, 0xF2, 0x00, 0x25 };
+            std::copy(data, data + _countof(data), framer.buffer());
+            framer.set_buffer_len(_countof(data));
+
+            // simulate the frame received event
+            slave.frame_ready(&framer);
+
+            // check the result; the register reads back as 0xAE41
+            Assert::AreEqual(true, framer.was_sent);
+            Assert::AreEqual((uint16_t)0x0004, handler.last_address);
+            Assert::AreEqual((uint16_t)0x0001, handler.last_count);
+            Assert::AreEqual((uint16_t)0x0045, handler.last_values[0]);
+
+            // the response is an echo of the request
+            Assert::AreEqual((size_t)_countof(data), framer.buffer_len());
+            Assert::AreEqual(true, std::equal(data, data + _countof(data), framer.buffer()));
+        }
+
+        // FC23
+        [TestMethod]
+		void TestSlaveFC23ReadWriteMultipleRegisters()
+		{
+            // create the slave object
+            CSlaveHandler handler;
+            CModbusSlave slave(&handler);
+
+            // initialize with a test packet
+            // from http://www.modbus.org/docs/Modbus_Application_Protocol_V1_1b3.pdf
+            CFramerDummy framer;
+            framer.set_frame_address(0x11);
+            uint8_t data[] = { 0x17, 0x00, 0x03, 0x00, 0x06, 0x00, 0x0E, 0x00, 0x03, 0x06, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF };
+            std::copy(data, data + _countof(data), framer.buffer());
+            framer.set_buffer_len(_countof(data));
+
+            // simulate the frame received event
+            slave.frame_ready(&framer);
+
+            // check the result; the write is done before the read
+            Assert::AreEqual(true, framer.was_sent);
+            Assert::AreEqual((uint16_t)0x00FF, handler.last_values[0]);
+            Assert::AreEqual((uint16_t)0x00FF, handler.last_values[1]);
+            Assert::AreEqual((uint16_t)0x00FF, handler.last_values[2]);
+            Assert::AreEqual((uint16_t)0x0003, handler.last_address);
+            Assert::AreEqual((uint16_t)0x0006, handler.last_count);
+
+            // data packet
+            uint8_t response[] = { 0x17, 0x0C, 0xAE, 0x41, 0x56, 0x52, 0x43, 0x40, 0xAE, 0x41, 0x56, 0x52, 0x43, 0x40 };
+            Assert::AreEqual((size_t)_countof(response), framer.buffer_len());
+            Assert::AreEqual(true, std::equal(response, response + _countof(response), framer.buffer()));
+        }
+
+        // user supplied function
+        [TestMethod]
+		void TestSlaveCustomFunction()
+		{
+            // create the slave object with a vendor function code
+            CSlaveHandler handler;
+            CFunctionHandler custom;
+            IFunctionHandler* functions[256] = {};
+            functions[0x41] = &custom;
+            CModbusSlave slave(&handler, functions);
+
+            // initialize with a test packet
+            CFramerDummy framer;
+            framer.set_frame_address(0x11);
+            uint8_t data[] = { 0x41, 0x01, 0x02 };
+            std::copy(data, data + _countof(data), framer.buffer());
+            framer.set_buffer_len(_countof(data));
+
+            // simulate the frame received event
+            slave.frame_ready(&framer);
+
+            // check the result
+            Assert::AreEqual(true, custom.was_called);
+            Assert::AreEqual(true, framer.was_sent);
+            uint8_t response[] = { 0x41, 0x02, 0x02 };
+            Assert::AreEqual((size_t)_countof(response), framer.buffer_len());
+            Assert::AreEqual(true, std::equal(response, response + _countof(response), framer.buffer()));
+
+            // an unregistered function code must still be rejected
+            uint8_t unknown[] = { 0x42, 0x01, 0x02 };
+            std::copy(unknown, unknown + _countof(unknown), framer.buffer());
+            framer.set_buffer_len(_countof(unknown));
+            slave.frame_ready(&framer);
+            Assert::AreEqual((size_t)2, framer.buffer_len());
+            Assert::AreEqual((uint8_t)0xC2, framer.buffer()[0]); // exception
+            Assert::AreEqual((uint8_t)0x01, framer.buffer()[1]); // illegal function
+		}
+
+        // sparse register map
+        [TestMethod]
+		void TestSlaveRegisterMap()
+		{
+            // create the slave object with two arrays and a handler
+            CSlaveHandler handler;
+            uint16_t low[] = { 0x1234, 0x5678 };
+            uint16_t high[] = { 0x0000, 0x0000 };
+            CModbusSlaveHandlerMap::range ranges[] = {
+                { 0x0000, 2, low, NULL },
+                { 0x0002, 1, NULL, &handler },
+                { 0x03E8, 2, high, NULL },
+            };
+            Assert::AreEqual(true, CModbusSlaveHandlerMap::valid(ranges, _countof(ranges)));
+            CModbusSlaveHandlerMap map(ranges, _countof(ranges));
+            CModbusSlave slave(&map);
+
+            // read across the array and the handler
+            CFramerDummy framer;
+            framer.set_frame_address(0x11);
+            uint8_t read[] = { 0x03, 0x00, 0x00, 0x00, 0x03 };
+            std::copy(read, read + _countof(read), framer.buffer());
+            framer.set_buffer_len(_countof(read));
+            slave.frame_ready(&framer);
+            Assert::AreEqual((uint16_t)0x0002, handler.last_address);
+            Assert::AreEqual((uint16_t)0x0001, handler.last_count);
+            uint8_t response[] = { 0x03, 0x06, 0x12, 0x34, 0x56, 0x78, 0xAE, 0x41 };
+            Assert::AreEqual((size_t)_countof(response), framer.buffer_len());
+            Assert::AreEqual(true, std::equal(response, response + _countof(response), framer.buffer()));
+
+            // a read that runs into the gap must fail
+            uint8_t gap[] = { 0x03, 0x00, 0x02, 0x00, 0x02 };
+            std::copy(gap, gap + _countof(gap), framer.buffer());
+            framer.set_buffer_len(_countof(gap));
+            slave.frame_ready(&framer);
+            Assert::AreEqual((size_t)2, framer.buffer_len());
+            Assert::AreEqual((uint8_t)0x83, framer.buffer()[0]); // exception
+            Assert::AreEqual((uint8_t)0x02, framer.buffer()[1]); // illegal data address
+
+            // a write that is partly unmapped must not change anything
+            uint8_t partial[] = { 0x10, 0x03, 0xE7, 0x00, 0x02, 0x04, 0xAA, 0xAA, 0xBB, 0xBB };
+            std::copy(partial, partial + _countof(partial), framer.buffer());
+            framer.set_buffer_len(_countof(partial));
+            slave.frame_ready(&framer);
+            Assert::AreEqual((size_t)2, framer.buffer_len());
+            Assert::AreEqual((uint8_t)0x90, framer.buffer()[0]); // exception
+            Assert::AreEqual((uint8_t)0x02, framer.buffer()[1]); // illegal data address
+            Assert::AreEqual((uint16_t)0x0000, high[0]);
+
+            // write to the second array
+            uint8_t write[] = { 0x10, 0x03, 0xE8, 0x00, 0x02, 0x04, 0xAA, 0xAA, 0xBB, 0xBB };
+            std::copy(write, write + _countof(write), framer.buffer());
+            framer.set_buffer_len(_countof(write));
+            slave.frame_ready(&framer);
+            Assert::AreEqual((size_t)5, framer.buffer_len());
+            Assert::AreEqual((uint16_t)0xAAAA, high[0]);
+            Assert::AreEqual((uint16_t)0xBBBB, high[1]);
+		}
+
+        // packed coil bank
+        [TestMethod]
+		void TestSlaveCoilBank()
+		{
+            // create the slave object with 27 coils and 16 discrete inputs
+            uint8_t coils[] = { 0xCD, 0x6B, 0xB2, 0x0E };
+            uint8_t inputs[] = { 0xAC, 0xDB };
+            CModbusSlaveHandlerCoils handler(coils, 27, inputs, 16);
+            CModbusSlave slave(&handler);
+
+            // read coils that do not start on a byte boundary
+            CFramerDummy framer;
+            framer.set_frame_address(0x11);
+            uint8_t read[] = { 0x01, 0x00, 0x02, 0x00, 0x09 };
+            std::copy(read, read + _countof(read), framer.buffer());
+            framer.set_buffer_len(_countof(read));
+            slave.frame_ready(&framer);
+            uint8_t response[] = { 0x01, 0x02, 0xF3, 0x00 };
+            Assert::AreEqual((size_t)_countof(response), framer.buffer_len());
+            Assert::AreEqual(true, std::equal(response, response + _countof(response), framer.buffer()));
+
+            // a read past the last coil must fail
+            uint8_t past[] = { 0x01, 0x00, 0x14, 0x00, 0x08 };
+            std::copy(past, past + _countof(past), framer.buffer());
+            framer.set_buffer_len(_countof(past));
+            slave.frame_ready(&framer);
+            Assert::AreEqual((size_t)2, framer.buffer_len());
+            Assert::AreEqual((uint8_t)0x81, framer.buffer()[0]); // exception
+            Assert::AreEqual((uint8_t)0x02, framer.buffer()[1]); // illegal data address
+
+            // write 4 coils in the middle of the first byte
+            uint8_t write[] = { 0x0F, 0x00, 0x03, 0x00, 0x04, 0x01, 0x0A };
+            std::copy(write, write + _countof(write), framer.buffer());
+            framer.set_buffer_len(_countof(write));
+            slave.frame_ready(&framer);
+            Assert::AreEqual((size_t)5, framer.buffer_len());
+            Assert::AreEqual((uint8_t)0xD5, coils[0]);
+            Assert::AreEqual((uint8_t)0x6B, coils[1]);
+
+            // read the discrete inputs
+            uint8_t discrete[] = { 0x02, 0x00, 0x00, 0x00, 0x10 };
+            std::copy(discrete, discrete + _countof(discrete), framer.buffer());
+            framer.set_buffer_len(_countof(discrete));
+            slave.frame_ready(&framer);
+            uint8_t discrete_response[] = { 0x02, 0x02, 0xAC, 0xDB };
+            Assert::AreEqual((size_t)_countof(discrete_response), framer.buffer_len());
+            Assert::AreEqual(true, std::equal(discrete_response, discrete_response + _countof(discrete_response), framer.buffer()));
+		}
+
+        // registers in the PDU byte order
+        [TestMethod]
+		void TestSlaveBigEndianRegisters()
+		{
+            // create the slave object
+            CBigEndianSlaveHandler handler;
+            CModbusSlave slave(&handler);
+
+            // write two registers; the handler gets the bytes as they are in the frame
+            CFramerDummy framer;
+            framer.set_frame_address(0x11);
+            uint8_t write[] = { 0x10, 0x00, 0x00, 0x00, 0x02, 0x04, 0x12, 0x34, 0x56, 0x78 };
+            std::copy(write, write + _countof(write), framer.buffer());
+            framer.set_buffer_len(_countof(write));
+            slave.frame_ready(&framer);
+            const uint8_t* stored = (const uint8_t*)handler.registers;
+            Assert::AreEqual((uint8_t)0x12, stored[0]);
+            Assert::AreEqual((uint8_t)0x34, stored[1]);
+
+            // a single register value is converted for the handler
+            uint8_t single[] = { 0x06, 0x00, 0x02, 0xAB, 0xCD };
+            std::copy(single, single + _countof(single), framer.buffer());
+            framer.set_buffer_len(_countof(single));
+            slave.frame_ready(&framer);
+            Assert::AreEqual((uint8_t)0xAB, stored[4]);
+            Assert::AreEqual((uint8_t)0xCD, stored[5]);
+
+            // read them back unchanged
+            uint8_t read[] = { 0x03, 0x00, 0x00, 0x00, 0x03 };
+            std::copy(read, read + _countof(read), framer.buffer());
+            framer.set_buffer_len(_countof(read));
+            slave.frame_ready(&framer);
+            uint8_t response[] = { 0x03, 0x06, 0x12, 0x34, 0x56, 0x78, 0xAB, 0xCD };
+            Assert::AreEqual((size_t)_countof(response), framer.buffer_len());
+            Assert::AreEqual(true, std::equal(response, response + _countof(response), framer.buffer()));
+		}
+
+        // register bank shared with other threads
+        [TestMethod]
+		void TestSlaveRegisterBank()
+		{
+            // create the slave object with 4 registers
+            CModbusSlaveHandlerBank::register_type registers[4];
+            registers[0] = 0x1234;
+            registers[1] = 0x5678;
+            registers[2] = 0x0000;
+            registers[3] = 0x0000;
+            CModbusSlaveHandlerBank bank(registers, _countof(registers));
+            CModbusSlave slave(&bank);
+
+            // read the first two registers
+            CFramerDummy framer;
+            framer.set_frame_address(0x11);
+            uint8_t read[] = { 0x03, 0x00, 0x00, 0x00, 0x02 };
+            std::copy(read, read + _countof(read), framer.buffer());
+            framer.set_buffer_len(_countof(read));
+            slave.frame_ready(&framer);
+            uint8_t response[] = { 0x03, 0x04, 0x12, 0x34, 0x56, 0x78 };
+            Assert::AreEqual((size_t)_countof(response), framer.buffer_len());
+            Assert::AreEqual(true, std::equal(response, response + _countof(response), framer.buffer()));
+
+            // write the last two
+            uint8_t write[] = { 0x10, 0x00, 0x02, 0x00, 0x02, 0x04, 0xAA, 0xAA, 0xBB, 0xBB };
+            std::copy(write, write + _countof(write), framer.buffer());
+            framer.set_buffer_len(_countof(write));
+            slave.frame_ready(&framer);
+            Assert::AreEqual((size_t)5, framer.buffer_len());
+            Assert::AreEqual((uint16_t)0xAAAA, (uint16_t)registers[2]);
+            Assert::AreEqual((uint16_t)0xBBBB, (uint16_t)registers[3]);
+
+            // mask write the first one; the request is echoed back
+            uint8_t mask[] = { 0x16, 0x00, 0x00, 0x00, 0xF2, 0x00, 0x25 };
+            std::copy(mask, mask + _countof(mask), framer.buffer());
+            framer.set_buffer_len(_countof(mask));
+            slave.frame_ready(&framer);
+            Assert::AreEqual((size_t)_countof(mask), framer.buffer_len());
+            Assert::AreEqual(true, std::equal(mask, mask + _countof(mask), framer.buffer()));
+            Assert::AreEqual((uint16_t)0x0035, (uint16_t)registers[0]);
+
+            // write the last register and read back the last three; the write goes first
+            uint8_t read_write[] = { 0x17, 0x00, 0x01, 0x00, 0x03, 0x00, 0x03, 0x00, 0x01, 0x02, 0xCC, 0xCC };
+            std::copy(read_write, read_write + _countof(read_write), framer.buffer());
+            framer.set_buffer_len(_countof(read_write));
+            slave.frame_ready(&framer);
+            uint8_t read_write_response[] = { 0x17, 0x06, 0x56, 0x78, 0xAA, 0xAA, 0xCC, 0xCC };
+            Assert::AreEqual((size_t)_countof(read_write_response), framer.buffer_len());
+            Assert::AreEqual(true, std::equal(read_write_response, read_write_response + _countof(read_write_response), framer.buffer()));
+            Assert::AreEqual((uint16_t)0xCCCC, (uint16_t)registers[3]);
+
+            // a read past the last register must fail
+            uint8_t past[] = { 0x03, 0x00, 0x03, 0x00, 0x02 };
+            std::copy(past, past + _countof(past), framer.buffer());
+            framer.set_buffer_len(_countof(past));
+            slave.frame_ready(&framer);
+            Assert::AreEqual((size_t)2, framer.buffer_len());
+            Assert::AreEqual((uint8_t)0x83, framer.buffer()[0]); // exception
+            Assert::AreEqual((uint8_t)0x02, framer.buffer()[1]); // illegal data address
+		}
     };
 }